@@ -16,6 +16,8 @@
 # Tips: 
 # - One can always pipe this output to grep for FIFO / RR tasks..
 # - the tuna(8) program performs this and much more! check it out...
+# Note: this forks several processes per thread alive; on a large system, use
+# the (much faster, single-pass) C version instead: query_task_sched/
 #
 # For details, pl refer to the book Ch 10.
 i=1
@@ -0,0 +1,257 @@
+/*
+ * ch10/query_task_sched/query_task_sched.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 10: The CPU Scheduler, Part 1
+ ****************************************************************
+ * Brief Description:
+ *
+ * Query the scheduling attributes of all threads currently alive on the
+ * system - a fast C replacement for our ch10/query_task_sched.sh script.
+ * The script runs chrt(1) and several awk's per thread; with thousands of
+ * threads that takes a very long time. Here, we walk /proc/PID/task/ once and
+ * issue the sched_getattr(2) system call directly on each thread, which also
+ * gets us the SCHED_DEADLINE parameters (runtime, deadline, period) and the
+ * nice value. As with the script, real-time threads are 'highlighted' with one
+ * star, and those at RT priority 99 with three.
+ *
+ * Usage: query_task_sched [-p policy[,policy...]] [-s]
+ *  -p : show only threads with these policies; any of
+ *       other,fifo,rr,batch,idle,deadline (or 'rt' for fifo,rr,deadline)
+ *  -s : print only the summary (the per policy thread counts)
+ *
+ * For details, pl refer to the book Ch 10.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#ifndef SCHED_BATCH
+#define SCHED_BATCH		3
+#endif
+#ifndef SCHED_IDLE
+#define SCHED_IDLE		5
+#endif
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE		6
+#endif
+#define NPOLICIES		7
+#define SCHED_FLAG_RESET_ON_FORK	0x01
+
+/* Our own copy of the kernel's struct sched_attr (older glibc's lack it) */
+struct llkd_sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;		/* SCHED_OTHER, SCHED_BATCH */
+	uint32_t sched_priority;	/* SCHED_FIFO, SCHED_RR */
+	uint64_t sched_runtime;		/* SCHED_DEADLINE (ns) */
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+static const char *policy_name[NPOLICIES] = {
+	[SCHED_OTHER] = "SCHED_OTHER",
+	[SCHED_FIFO] = "SCHED_FIFO",
+	[SCHED_RR] = "SCHED_RR",
+	[SCHED_BATCH] = "SCHED_BATCH",
+	[4] = "SCHED_ISO?",		/* reserved, unused by mainline */
+	[SCHED_IDLE] = "SCHED_IDLE",
+	[SCHED_DEADLINE] = "SCHED_DEADLINE",
+};
+
+static int sched_getattr_tid(pid_t tid, struct llkd_sched_attr *attr)
+{
+	return syscall(SYS_sched_getattr, tid, attr, sizeof(struct llkd_sched_attr), 0);
+}
+
+/* Parse the -p option: a comma separated list of policy names -> bitmask */
+static unsigned int parse_policies(char *arg)
+{
+	unsigned int mask = 0;
+	char *tok;
+
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (!strcasecmp(tok, "other") || !strcasecmp(tok, "normal"))
+			mask |= 1 << SCHED_OTHER;
+		else if (!strcasecmp(tok, "fifo"))
+			mask |= 1 << SCHED_FIFO;
+		else if (!strcasecmp(tok, "rr"))
+			mask |= 1 << SCHED_RR;
+		else if (!strcasecmp(tok, "batch"))
+			mask |= 1 << SCHED_BATCH;
+		else if (!strcasecmp(tok, "idle"))
+			mask |= 1 << SCHED_IDLE;
+		else if (!strcasecmp(tok, "deadline") || !strcasecmp(tok, "dl"))
+			mask |= 1 << SCHED_DEADLINE;
+		else if (!strcasecmp(tok, "rt"))
+			mask |= 1 << SCHED_FIFO | 1 << SCHED_RR | 1 << SCHED_DEADLINE;
+		else {
+			fprintf(stderr, "unknown policy '%s'\n", tok);
+			exit(EXIT_FAILURE);
+		}
+	}
+	return mask;
+}
+
+/* Read the thread's comm (relative to it's /proc/PID/task dir fd) */
+static void read_comm(int taskfd, const char *tid, char *buf, size_t len)
+{
+	char path[NAME_MAX + 8];
+	ssize_t n = -1;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/comm", tid);
+	fd = openat(taskfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		n = read(fd, buf, len - 1);
+		close(fd);
+	}
+	if (n <= 0) {
+		strncpy(buf, "?", len);
+		return;
+	}
+	if (buf[n - 1] == '\n')
+		n--;
+	buf[n] = '\0';
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-p policy[,policy...]] [-s]\n"
+		" -p : show only threads with these policies; any of\n"
+		"      other,fifo,rr,batch,idle,deadline (or 'rt' for fifo,rr,deadline)\n"
+		" -s : print only the summary (the per policy thread counts)\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long count[NPOLICIES] = { 0 }, nthreads = 0, nshown = 0, nprio99 = 0;
+	unsigned int filter = ~0U;
+	struct llkd_sched_attr attr;
+	struct timespec t1, t2;
+	struct dirent *de, *te;
+	int opt, summary_only = 0, procfd, taskfd, i;
+	char comm[32], path[NAME_MAX + 8];
+	DIR *dir, *tdir;
+	pid_t pid, tid;
+
+	while ((opt = getopt(argc, argv, "p:sh")) != -1) {
+		switch (opt) {
+		case 'p':
+			filter = parse_policies(optarg);
+			break;
+		case 's':
+			summary_only = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	dir = opendir("/proc");
+	if (!dir) {
+		perror("opendir /proc");
+		exit(EXIT_FAILURE);
+	}
+	procfd = dirfd(dir);
+
+	if (!summary_only)
+		printf("  PID       TID            Name                     Sched Policy  Prio  Nice"
+		       "    *RT  [runtime/deadline/period (us)]\n");
+	while ((de = readdir(dir))) {
+		if (!isdigit((unsigned char)de->d_name[0]))
+			continue;
+		pid = atoi(de->d_name);
+
+		/* the process may die under us at any point; just skip it then */
+		snprintf(path, sizeof(path), "%s/task", de->d_name);
+		taskfd = openat(procfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (taskfd < 0)
+			continue;
+		tdir = fdopendir(taskfd);
+		if (!tdir) {
+			close(taskfd);
+			continue;
+		}
+		while ((te = readdir(tdir))) {
+			if (!isdigit((unsigned char)te->d_name[0]))
+				continue;
+			tid = atoi(te->d_name);
+			memset(&attr, 0, sizeof(attr));
+			if (sched_getattr_tid(tid, &attr) < 0)
+				continue;	/* it's gone */
+			nthreads++;
+			if (attr.sched_policy < NPOLICIES)
+				count[attr.sched_policy]++;
+			if ((attr.sched_policy == SCHED_FIFO || attr.sched_policy == SCHED_RR)
+			    && attr.sched_priority == 99)
+				nprio99++;
+			if (attr.sched_policy >= 32 || !(filter & (1U << attr.sched_policy)))
+				continue;
+			nshown++;
+			if (summary_only)
+				continue;
+
+			read_comm(taskfd, te->d_name, comm, sizeof(comm));
+			printf("%6d  ", pid);
+			if (tid != pid)		/* a child thread: indent to the right */
+				printf("  %6d%32s", tid, comm);
+			else
+				printf("%6d  %32s", tid, comm);
+			printf("   %14s   %2u  %4d",
+			       attr.sched_policy < NPOLICIES ? policy_name[attr.sched_policy] : "?",
+			       attr.sched_priority, attr.sched_nice);
+			switch (attr.sched_policy) {
+			case SCHED_FIFO:
+			case SCHED_RR:
+				printf("  %s", attr.sched_priority == 99 ? "***" : "*");
+				break;
+			case SCHED_DEADLINE:
+				printf("  *    [%llu/%llu/%llu]",
+				       (unsigned long long)attr.sched_runtime / 1000,
+				       (unsigned long long)attr.sched_deadline / 1000,
+				       (unsigned long long)attr.sched_period / 1000);
+				break;
+			}
+			if (attr.sched_flags & SCHED_FLAG_RESET_ON_FORK)
+				printf("  (reset-on-fork)");
+			printf("\n");
+		}
+		closedir(tdir);		/* also closes taskfd */
+	}
+	closedir(dir);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	printf("\nSummary: %lu threads", nthreads);
+	if (filter != ~0U)
+		printf(" (%lu match the policy filter)", nshown);
+	printf("\n");
+	for (i = 0; i < NPOLICIES; i++) {
+		if (count[i])
+			printf(" %-15s : %6lu\n", policy_name[i], count[i]);
+	}
+	if (nprio99)
+		printf(" (of which %lu RT threads run at priority 99)\n", nprio99);
+	fprintf(stderr, "[%lu threads scanned in %.3f ms]\n", nthreads,
+		(t2.tv_sec - t1.tv_sec) * 1e3 + (t2.tv_nsec - t1.tv_nsec) / 1e6);
+	exit(EXIT_SUCCESS);
+}
@@ -10,6 +10,8 @@
 # ****************************************************************
 # Brief Description:
 # A quick test case for cgroups v2 CPU controller.
+# (To see the effect of cpu.max on latency - not just throughput - see the
+# cgv2_cpu_lat_sweep.sh harness.)
 #
 # For details, pl refer to the book Ch 11.
 #                                                                      
@@ -40,13 +42,13 @@ echo "[+] Launch processes j1 and j2 (slinks to ${TD}/simp.sh) now ..."
 rm -f j1                                                               
 ln -sf ${TD}/simp.sh j1                                                
 ./j1 1 >${OUT1} &                                                      
-j1pid=$(ps -A|grep j1|head -n1|awk '{print $1}')                       
+j1pid=$!   # (not via ps: j1 may exec the cpuburn_req burner)
                                                                        
 #--- Run a job j2
 rm -f j2
 ln -sf ${TD}/simp.sh j2
 ./j2 900 >${OUT2} &
-j2pid=$(ps -A|grep j2|head -n1|awk '{print $1}')
+j2pid=$!
 
 echo "[+] Insert processes j1 and j2 into our new CPU ctrl sub-group"                                   
 #--- Put j1 there
@@ -0,0 +1,158 @@
+#!/bin/bash
+# ch11/cgroups_v2_cpu_eg/cgv2_cpu_lat_sweep.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Programming"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Programming
+# ****************************************************************
+# Brief Description:
+# A cgroups v2 CPU controller *latency* harness, extending cgv2_cpu_ctrl.sh.
+# That script shows how cpu.max limits throughput; this one shows what it does
+# to latency. For every combination of bandwidth (% of a CPU) and period in
+# our sweep, we set cpu.max (quota = pct * period) on our sub-group, run the
+# calibrated request-style workload cpuburn_req inside it and report:
+#  - the group's throttling, from it's cpu.stat: # of periods, # of them
+#    throttled, and the total throttled time
+#  - the workload's wakeup and response (tail) latencies
+# The same quota percentage with a shorter period usually means shorter (but
+# more frequent) throttled stretches - i.e., a lower tail latency; that's what
+# to tune for latency-sensitive containers.
+#
+# For details, pl refer to the book Ch 11.
+#
+# Additional Ref:
+# https://www.kernel.org/doc/html/latest/admin-guide/cgroup-v2.html#cpu
+name=$(basename $0)
+TDIR=test_group_lat
+TD=$(dirname $(realpath $0))
+BURNER=${TD}/cpuburn_req
+
+# Defaults; override via the options
+DURATION=5	# seconds per setting
+RATE=1000	# requests per second
+WORK_US=200	# CPU per request (us); RATE*WORK_US = 20% of a CPU
+HOGS=0		# background hog threads
+PCTS="100 50 30"		# bandwidth, % of a CPU
+PERIODS="100000 20000 5000"	# cpu.max periods (us)
+
+usage()
+{
+  echo "Usage: ${name} [-d secs] [-r req/s] [-w work-us] [-b hogs] [-q \"pct ...\"] [-p \"period-us ...\"]
+ -d : duration of each run, seconds (default ${DURATION})
+ -r : request arrival rate, per second (default ${RATE})
+ -w : CPU work per request, us (default ${WORK_US})
+ -b : # of background CPU hog threads in the group (default ${HOGS})
+ -q : the cpu.max bandwidth values to sweep, in % of a CPU (default \"${PCTS}\")
+ -p : the cpu.max period values to sweep, in us (default \"${PERIODS}\")"
+}
+
+# cleanup
+remove_subgroup()
+{
+[ -d ${CGV2_MNT}/${TDIR} ] && {
+  echo "[+] Removing our cpu sub-group controller"
+  rmdir ${CGV2_MNT}/${TDIR}
+}
+} # end remove_subgroup()
+
+# cpu_stat_val <key> : the value of 'key' in our sub-group's cpu.stat
+cpu_stat_val()
+{
+awk -v k=$1 '$1 == k {print $2}' ${CGV2_MNT}/${TDIR}/cpu.stat
+}
+
+# run_one <quota-us> <period-us> : run the workload under this cpu.max setting
+run_one()
+{
+local quota=$1 period=$2 p0 t0 u0 p1 t1 u1 res
+echo "${quota} ${period}" > ${CGV2_MNT}/${TDIR}/cpu.max || {
+  echo "Error! updating cpu.max for our sub-control group failed"
+  return 1
+}
+p0=$(cpu_stat_val nr_periods) ; t0=$(cpu_stat_val nr_throttled)
+u0=$(cpu_stat_val throttled_usec)
+
+# Move a subshell into the group and exec the workload from there, so that
+# all of it - including the calibration and any hog threads - runs in it
+res=$(sh -c "echo \$\$ > ${CGV2_MNT}/${TDIR}/cgroup.procs && \
+      exec ${BURNER} -m -d ${DURATION} -r ${RATE} -w ${WORK_US} -b ${HOGS}")
+[ -z "${res}" ] && return 1
+
+p1=$(cpu_stat_val nr_periods) ; t1=$(cpu_stat_val nr_throttled)
+u1=$(cpu_stat_val throttled_usec)
+# sets requests, queued, wake_p50, ..., resp_max
+eval ${res}
+printf "%4d%% %8d %8d | %7d %7d %9.1f | %8.1f %8.1f | %9.1f %9.1f %9.1f %9.1f\n" \
+  $((quota * 100 / period)) ${quota} ${period} \
+  $((p1 - p0)) $((t1 - t0)) $(bc <<< "scale=1; (${u1} - ${u0}) / 1000") \
+  ${wake_p50} ${wake_p99} ${resp_p50} ${resp_p99} ${resp_p999} ${resp_max}
+}
+
+
+### "main" here
+
+while getopts "d:r:w:b:q:p:h" opt; do
+  case "${opt}" in
+    d) DURATION=${OPTARG} ;;
+    r) RATE=${OPTARG} ;;
+    w) WORK_US=${OPTARG} ;;
+    b) HOGS=${OPTARG} ;;
+    q) PCTS=${OPTARG} ;;
+    p) PERIODS=${OPTARG} ;;
+    *) usage ; exit 1 ;;
+  esac
+done
+
+[ $(id -u) -ne 0 ] && {
+   echo "$0: need root."
+   exit 1
+}
+which bc >/dev/null || {
+  echo "${name}: the 'bc' utility is  missing; pl install and retry"
+  exit 1
+}
+[ ! -x ${BURNER} ] && {
+  echo "${name}: ${BURNER} not built? run 'make' first; aborting..."
+  exit 1
+}
+mount |grep -q cgroup2 || {
+  echo "No cgroup2 filesystem mounted? Pl mount one first; aborting..."
+  exit 1
+}
+export CGV2_MNT=$(mount |grep cgroup2 |head -n1 |awk '{print $3}')
+[ -z "${CGV2_MNT}" ] && {
+  echo "cgroup2 filesystem not acquired, aborting..."
+  exit 1
+}
+
+echo "[+] Adding a 'cpu' controller to the cgroups v2 hierarchy"
+echo "+cpu" > ${CGV2_MNT}/cgroup.subtree_control || {
+  echo "Adding cpu controller failed, aborting (see cgv2_cpu_ctrl.sh for tips)"
+  exit 1
+}
+remove_subgroup
+echo "[+] Create a sub-group under it (here: ${CGV2_MNT}/${TDIR})"
+mkdir ${CGV2_MNT}/${TDIR} || {
+  echo "Warning! creating sub-dir ${CGV2_MNT}/${TDIR} failed..."
+  exit 1
+}
+trap 'remove_subgroup' EXIT
+
+echo "[+] Workload: ${RATE} req/s x ${WORK_US} us CPU ($(bc <<< "scale=1; ${RATE}*${WORK_US}/10000")% of a CPU), ${HOGS} hog(s), ${DURATION} s per setting
+"
+echo "                         |        throttling         |  wakeup (us)      |            response (us)"
+echo "  bw    quota   period   | periods   thrtl  thrtl_ms |      p50      p99 |       p50       p99     p99.9       max"
+for pct in ${PCTS}; do
+  for period in ${PERIODS}; do
+    quota=$((pct * period / 100))
+    [ ${quota} -lt 1000 ] && {   # the kernel's minimum quota is 1 ms
+      echo "($pct% of ${period} us: quota < 1000 us, skipped)"
+      continue
+    }
+    run_one ${quota} ${period} || echo "($pct% of ${period} us: run failed)"
+  done
+done
+exit 0
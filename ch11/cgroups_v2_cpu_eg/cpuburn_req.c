@@ -0,0 +1,224 @@
+/*
+ * ch11/cgroups_v2_cpu_eg/cpuburn_req.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 11 : CPU Scheduling, Part 2
+ ****************************************************************
+ * Brief Description:
+ * A calibrated CPU burner running a 'request-style' workload: the kind of
+ * latency-sensitive service whose behaviour under a cgroup v2 cpu.max
+ * bandwidth limit we want to see (the simp.sh loops just show throughput).
+ *
+ * At startup we calibrate our busy loop - how many iterations burn 1 us of
+ * *CPU* time (measured via the thread CPU-time clock, so that the calibration
+ * holds even if we're being throttled while doing it). Then, requests arrive
+ * open-loop at a fixed rate (-r per second), each costing -w us of CPU; the
+ * worker sleeps until each request's (absolute) arrival time and serves it.
+ * Per request, we record:
+ *  wakeup latency : how late we woke up for it (0 if we were already late)
+ *  response time  : arrival to completion; includes any queueing behind
+ *                   earlier requests - which is where throttling shows up
+ * Optionally, -b background 'hog' threads burn CPU nonstop, using up the
+ * group's quota as a busy neighbour in the same container would.
+ * (The calibrated burner itself is lkp_burn_*(), in our convenient.h.)
+ *
+ * Also, a 'ticker' mode (-t start): emit integers from 'start' (up to 9999),
+ * one per TICK_US of CPU consumed; the count emitted in a given time is thus
+ * a direct measure of the CPU bandwidth we got. The simp.sh job script (of
+ * cgv2_cpu_ctrl.sh) uses it.
+ *
+ * Usage: cpuburn_req [-d secs] [-r req/s] [-w work-us] [-b hogs] [-m]
+ *        cpuburn_req -t start
+ *  -m : machine-readable (key=value) output, for cgv2_cpu_lat_sweep.sh
+ *
+ * For details, pl refer to the book Ch 11.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../../convenient.h"
+
+#define TICK_US		10000	/* ticker mode: CPU time per tick */
+#define TICK_MAX	9999
+
+static volatile int stop_hogs;
+
+static inline uint64_t now_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *hog(void *arg)
+{
+	while (!stop_hogs)
+		lkp_burn_us(1000);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The (sorted) @v's @pct percentile, in us */
+static double pctile(const uint64_t *v, long n, double pct)
+{
+	long idx = (long)(n * pct / 100.0);
+
+	if (idx >= n)
+		idx = n - 1;
+	return v[idx] / 1000.0;
+}
+
+/* Ticker mode: print integers from @start, one per TICK_US of CPU */
+static void ticker(int start)
+{
+	int i;
+
+	for (i = start; i <= TICK_MAX; i++) {
+		printf("%d ", i);
+		fflush(stdout);		/* we're usually killed, not exited */
+		lkp_burn_us(TICK_US);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-d secs] [-r req/s] [-w work-us] [-b hogs] [-m]\n"
+		"       %s -t start\n"
+		" -d : duration in seconds (default 5)\n"
+		" -r : request arrival rate, per second (default 1000)\n"
+		" -w : CPU work per request, in us (default 200)\n"
+		" -b : # of background CPU hog threads (default 0)\n"
+		" -m : machine-readable (key=value) output\n"
+		" -t : ticker mode: print integers from start (to %d), one per %d us of CPU\n",
+		name, name, TICK_MAX, TICK_US);
+}
+
+int main(int argc, char **argv)
+{
+	double secs = 5, work_us = 200, rate = 1000;
+	uint64_t *wake, *resp, start, arrival, t, cpu1, cpu2;
+	int opt, nhogs = 0, machine = 0, i;
+	long nreq, r, nlate = 0;
+	struct timespec ts;
+	pthread_t *hogs = NULL;
+
+	while ((opt = getopt(argc, argv, "d:r:w:b:mt:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			secs = atof(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'w':
+			work_us = atof(optarg);
+			break;
+		case 'b':
+			nhogs = atoi(optarg);
+			break;
+		case 'm':
+			machine = 1;
+			break;
+		case 't':
+			lkp_burn_calibrate();
+			ticker(atoi(optarg));
+			exit(EXIT_SUCCESS);
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+	nreq = (long)(secs * rate);
+	if (nreq <= 0 || work_us < 0 || nhogs < 0) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	wake = calloc(nreq, sizeof(uint64_t));
+	resp = calloc(nreq, sizeof(uint64_t));
+	if (!wake || !resp) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	lkp_burn_calibrate();
+	if (!machine)
+		printf("calibrated: %.1f loops/us; %ld requests of %.0f us CPU at %.0f/s "
+		       "(%.1f%% of a CPU), %d hog thread(s)\n", lkp_loops_per_ms / 1e3, nreq, work_us,
+		       rate, work_us * rate / 1e4, nhogs);
+
+	if (nhogs) {
+		hogs = calloc(nhogs, sizeof(pthread_t));
+		for (i = 0; hogs && i < nhogs; i++)
+			if (pthread_create(&hogs[i], NULL, hog, NULL)) {
+				perror("pthread_create");
+				exit(EXIT_FAILURE);
+			}
+	}
+
+	cpu1 = now_ns(CLOCK_THREAD_CPUTIME_ID);
+	start = now_ns(CLOCK_MONOTONIC) + 10000000;	/* begin in 10 ms */
+	for (r = 0; r < nreq; r++) {
+		arrival = start + (uint64_t)(r * 1e9 / rate);
+		t = now_ns(CLOCK_MONOTONIC);
+		if (t < arrival) {
+			ts.tv_sec = arrival / 1000000000ULL;
+			ts.tv_nsec = arrival % 1000000000ULL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			t = now_ns(CLOCK_MONOTONIC);
+			wake[r] = t - arrival;
+		} else {
+			wake[r] = 0;	/* still busy with earlier requests: it queued */
+			nlate++;
+		}
+		lkp_burn_ns((uint64_t)(work_us * 1e3));
+		resp[r] = now_ns(CLOCK_MONOTONIC) - arrival;
+	}
+	cpu2 = now_ns(CLOCK_THREAD_CPUTIME_ID);
+
+	stop_hogs = 1;
+	for (i = 0; hogs && i < nhogs; i++)
+		pthread_join(hogs[i], NULL);
+
+	qsort(wake, nreq, sizeof(uint64_t), cmp_u64);
+	qsort(resp, nreq, sizeof(uint64_t), cmp_u64);
+	if (machine) {
+		printf("requests=%ld queued=%ld work_us_actual=%.1f wake_p50=%.1f wake_p99=%.1f "
+		       "wake_max=%.1f resp_p50=%.1f resp_p99=%.1f resp_p999=%.1f resp_max=%.1f\n",
+		       nreq, nlate, (cpu2 - cpu1) / 1e3 / nreq,
+		       pctile(wake, nreq, 50), pctile(wake, nreq, 99), wake[nreq - 1] / 1e3,
+		       pctile(resp, nreq, 50), pctile(resp, nreq, 99), pctile(resp, nreq, 99.9),
+		       resp[nreq - 1] / 1e3);
+	} else {
+		printf("CPU per request: %.1f us (asked for %.0f); %ld of %ld requests queued\n",
+		       (cpu2 - cpu1) / 1e3 / nreq, work_us, nlate, nreq);
+		printf("latency (us)   %10s %10s %10s %10s\n", "p50", "p99", "p99.9", "max");
+		printf(" wakeup        %10.1f %10.1f %10.1f %10.1f\n", pctile(wake, nreq, 50),
+		       pctile(wake, nreq, 99), pctile(wake, nreq, 99.9), wake[nreq - 1] / 1e3);
+		printf(" response      %10.1f %10.1f %10.1f %10.1f\n", pctile(resp, nreq, 50),
+		       pctile(resp, nreq, 99), pctile(resp, nreq, 99.9), resp[nreq - 1] / 1e3);
+	}
+
+	free(hogs);
+	free(wake);
+	free(resp);
+	exit(EXIT_SUCCESS);
+}
@@ -13,6 +13,10 @@
 # This simple script hammers the CPU(s), emitting integer values...
 # The value to start with is passed as a parameter to it; it's used to
 # get an approximation of the CPU loading.
+# If built, we hand over to the calibrated burner (cpuburn_req -t): it emits
+# one integer per fixed amount (10 ms) of CPU time consumed, so that the
+# counts are directly comparable; else, we fall back to burning CPU in a
+# (bash) loop here - whose speed depends on the box and the shell.
 # Do NOT invoke this script directly; it's meant to be invoked from the
 # ch11/cgroups_v2_cpu_eg/cgv2_cpu_ctrl.sh bash script.
 #
@@ -29,6 +33,9 @@ max=9999
  exit 1
 }
 
+BURNER=$(dirname $(realpath $0))/cpuburn_req
+[ -x ${BURNER} ] && exec ${BURNER} -t $1
+
 delay_loop()
 {
 SEQ_MAX1=10
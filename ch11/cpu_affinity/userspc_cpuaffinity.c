@@ -15,6 +15,19 @@
  * given process or thread (via PID). If no PID is explicitly provided,
  * we just display the CPU mask of the calling process (this app).
  *
+ * CPU masks are dynamically sized (CPU_ALLOC(3)), so any number of CPUs - not
+ * just 64 - is supported. Besides the (legacy) hex/decimal bitmask, the new
+ * mask can be given as a cpulist (-c 0-7,16-23), or be computed from the
+ * system's CPU topology (as seen under /sys/devices/system/cpu) relative to a
+ * reference CPU (-r, default: the one we're running on):
+ *  -t core     : the reference CPU's core (it and it's SMT siblings)
+ *  -t llc      : all CPUs sharing it's last level cache
+ *  -t node     : all CPUs on it's NUMA node
+ *  -t spread:N : N CPUs spread out as far as possible - across NUMA nodes
+ *                first, then LLCs, then cores
+ * With -a, the mask is applied to all threads of the process, not just the
+ * one whose PID (TID) is given.
+ *
  * For details, please refer the book, Ch 11.
  */
 #define _GNU_SOURCE
@@ -23,10 +36,105 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sched.h>
 
-static unsigned int numcores;
+#define SYSCPU		"/sys/devices/system/cpu"
+#define CPUS_PER_ROW	32	/* # of CPUs per row of the mask display */
+
+static unsigned int numcores;	/* # of configured (possible) CPUs */
+static size_t setsz;		/* size (bytes) of our dynamic CPU sets */
+
+static cpu_set_t *cpuset_alloc(void)
+{
+	cpu_set_t *set = CPU_ALLOC(numcores);
+
+	if (!set) {
+		perror("CPU_ALLOC failed");
+		exit(EXIT_FAILURE);
+	}
+	CPU_ZERO_S(setsz, set);
+	return set;
+}
+
+/*
+ * parse_cpulist()
+ * Parse a cpulist string - like "0-7,16-23" or "0,2,4-6" - into @set.
+ * Returns 0 on success, -1 on a malformed list or out of range CPU.
+ */
+static int parse_cpulist(const char *str, cpu_set_t *set)
+{
+	const char *s = str;
+	char *end;
+	long lo, hi, i;
+
+	CPU_ZERO_S(setsz, set);
+	while (*s && *s != '\n') {
+		lo = strtol(s, &end, 10);
+		if (end == s || lo < 0)
+			return -1;
+		hi = lo;
+		s = end;
+		if (*s == '-') {
+			s++;
+			hi = strtol(s, &end, 10);
+			if (end == s || hi < lo)
+				return -1;
+			s = end;
+		}
+		if (hi >= numcores) {
+			fprintf(stderr, "CPU %ld out of range (max %u)\n", hi, numcores - 1);
+			return -1;
+		}
+		for (i = lo; i <= hi; i++)
+			CPU_SET_S(i, setsz, set);
+		if (*s == ',')
+			s++;
+		else if (*s && *s != '\n')
+			return -1;
+	}
+	return 0;
+}
+
+/* Read a sysfs cpulist file (like .../cpuN/topology/core_cpus_list) into @set */
+static int read_cpulist_file(const char *path, cpu_set_t *set)
+{
+	char buf[4096];
+	FILE *fp = fopen(path, "r");
+	int ret = -1;
+
+	if (!fp)
+		return -1;
+	if (fgets(buf, sizeof(buf), fp))
+		ret = parse_cpulist(buf, set);
+	fclose(fp);
+	return ret;
+}
+
+/* Print @set in cpulist form */
+static void print_cpulist(cpu_set_t *set)
+{
+	int i, start = -1, first = 1;
+
+	for (i = 0; i <= (int)numcores; i++) {
+		if (i < numcores && CPU_ISSET_S(i, setsz, set)) {
+			if (start < 0)
+				start = i;
+			continue;
+		}
+		if (start < 0)
+			continue;
+		printf("%s%d", first ? "" : ",", start);
+		if (i - 1 > start)
+			printf("-%d", i - 1);
+		first = 0;
+		start = -1;
+	}
+	printf("%s", first ? "(none)" : "");
+}
 
 static inline void print_ruler(unsigned int len)
 {
@@ -42,110 +150,384 @@ static inline void print_ruler(unsigned int len)
 	printf("\n");
 }
 
-/* 
+/* Show the name and state of @pid - from /proc, no need to run ps(1) */
+static void disp_task(pid_t pid)
+{
+	char path[64], buf[512], *p;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+	if (fgets(buf, sizeof(buf), fp)) {
+		/* 'pid (comm) state ...'; the comm could contain ')' */
+		p = strrchr(buf, ')');
+		if (p && p[1] == ' ') {
+			p[1] = '\0';
+			printf("%s [state %c]\n", buf, p[2]);
+		}
+	}
+	fclose(fp);
+}
+
+/*
  * disp_cpumask()
  * Print the provided CPU bitmask @cpumask (along with the 'ruler' lines),
- * for a max of @ncores-1 CPU cores, in (a more intuitive) right-to-left order.
+ * for a max of @ncores-1 CPU cores, in (a more intuitive) right-to-left order;
+ * on boxes with many cores, CPUS_PER_ROW cores per row.
  */
 static void disp_cpumask(pid_t pid, cpu_set_t *cpumask, unsigned int ncores)
 {
-	int i;
-	char tmpbuf[128];
+	int i, lo, hi;
 
-	printf("CPU affinity mask for PID %d:\n", pid);
-	snprintf(tmpbuf, 127, "ps -A |awk '$1 == %d {print $0}'", pid);
-	if (system(tmpbuf) == -1)
-		fprintf(stderr, "Warning: %s():system(3) (to show ps output)"
-			" failed\n", __func__);
+	printf("CPU affinity mask for PID %d: ", pid);
+	print_cpulist(cpumask);
+	printf(" (%d CPUs)\n", CPU_COUNT_S(setsz, cpumask));
+	disp_task(pid);
 
-	print_ruler(ncores);
+	for (hi = ncores - 1; hi >= 0; hi -= CPUS_PER_ROW) {
+		lo = hi - CPUS_PER_ROW + 1;
+		if (lo < 0)
+			lo = 0;
+		print_ruler(hi - lo + 1);
 
-	printf("core#  |");
-	for (i=ncores-1; i>=0; i--)
-		printf("%2d|", i);
-	printf("\n");
-	print_ruler(ncores);
+		printf("core#  |");
+		for (i=hi; i>=lo; i--)
+			printf("%2d|", i % 100);
+		printf("\n");
+		print_ruler(hi - lo + 1);
 
-	printf("cpumask|");
-	for (i=ncores-1; i>=0; i--)
-		printf("%2u|", CPU_ISSET(i, cpumask));
-	printf("\n");
-	print_ruler(ncores);
+		printf("cpumask|");
+		for (i=hi; i>=lo; i--)
+			printf("%2u|", !!CPU_ISSET_S(i, setsz, cpumask));
+		printf("\n");
+	}
+	print_ruler(ncores < CPUS_PER_ROW ? ncores : CPUS_PER_ROW);
 }
 
 static int query_cpu_affinity(pid_t pid)
 {
-	cpu_set_t cpumask;
+	cpu_set_t *cpumask = cpuset_alloc();
 
-	CPU_ZERO(&cpumask);
-	if (sched_getaffinity(pid, sizeof(cpu_set_t), &cpumask) < 0) {
+	if (sched_getaffinity(pid, setsz, cpumask) < 0) {
 		perror("sched_getaffinity() failed");
+		CPU_FREE(cpumask);
 		return -1;
 	}
-	disp_cpumask(pid, &cpumask, numcores);
+	disp_cpumask(pid, cpumask, numcores);
+	CPU_FREE(cpumask);
 
 	return 0;
 }
 
-static int set_cpu_affinity(pid_t pid, unsigned long bitmask)
+/*---------------------- topology-aware placement ----------------------*/
+/* The set of CPUs sharing @cpu's core (SMT siblings) */
+static int topo_core(int cpu, cpu_set_t *set)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), SYSCPU "/cpu%d/topology/core_cpus_list", cpu);
+	if (!read_cpulist_file(path, set))
+		return 0;
+	/* older kernels */
+	snprintf(path, sizeof(path), SYSCPU "/cpu%d/topology/thread_siblings_list", cpu);
+	return read_cpulist_file(path, set);
+}
+
+/* The set of CPUs sharing @cpu's last level cache (the highest level one) */
+static int topo_llc(int cpu, cpu_set_t *set)
+{
+	char path[PATH_MAX];
+	int idx, level, maxlevel = -1, llc_idx = -1;
+	FILE *fp;
+
+	for (idx = 0; ; idx++) {
+		snprintf(path, sizeof(path), SYSCPU "/cpu%d/cache/index%d/level", cpu, idx);
+		fp = fopen(path, "r");
+		if (!fp)
+			break;
+		if (fscanf(fp, "%d", &level) == 1 && level > maxlevel) {
+			maxlevel = level;
+			llc_idx = idx;
+		}
+		fclose(fp);
+	}
+	if (llc_idx < 0)
+		return -1;
+	snprintf(path, sizeof(path), SYSCPU "/cpu%d/cache/index%d/shared_cpu_list", cpu, llc_idx);
+	return read_cpulist_file(path, set);
+}
+
+/* The NUMA node @cpu is on; the .../cpuN/nodeM link tells us; 0 if none */
+static int cpu_to_node(int cpu)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	int node = 0;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), SYSCPU "/cpu%d", cpu);
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+	while ((de = readdir(dir))) {
+		if (!strncmp(de->d_name, "node", 4) && isdigit((unsigned char)de->d_name[4])) {
+			node = atoi(de->d_name + 4);
+			break;
+		}
+	}
+	closedir(dir);
+	return node;
+}
+
+/* The set of CPUs on @cpu's NUMA node (or all online CPUs if not NUMA) */
+static int topo_node(int cpu, cpu_set_t *set)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", cpu_to_node(cpu));
+	if (!read_cpulist_file(path, set))
+		return 0;
+	return read_cpulist_file(SYSCPU "/online", set);
+}
+
+/* The lowest numbered CPU in @set; used as the 'id' of a core / LLC */
+static int first_cpu(cpu_set_t *set)
 {
-	cpu_set_t cpumask;
 	int i;
 
-	printf("\nSetting CPU affinity mask for PID %d now...\n", pid);
-	CPU_ZERO(&cpumask);
+	for (i = 0; i < numcores; i++)
+		if (CPU_ISSET_S(i, setsz, set))
+			return i;
+	return -1;
+}
 
-	/* Iterate over the given bitmask, setting CPU bits as required */
-	for (i=0; i<sizeof(unsigned long)*8; i++) {
-		/* printf("bit %d: %d\n", i, (bitmask >> i) & 1); */
-		if ((bitmask >> i) & 1)
-			CPU_SET(i, &cpumask);
+/*
+ * topo_spread()
+ * Choose @n online CPUs as far apart as possible: we repeatedly pick the CPU
+ * whose NUMA node, then LLC, then core, has the fewest CPUs already chosen
+ * (ties going to the lowest numbered CPU).
+ */
+static int topo_spread(int n, cpu_set_t *set)
+{
+	int *node, *llc, *core, *nnode, *nllc, *ncore, i, k, best;
+	cpu_set_t *online = cpuset_alloc(), *tmp = cpuset_alloc();
+	long score, bestscore;
+	int ret = -1;
+
+	if (read_cpulist_file(SYSCPU "/online", online) < 0)
+		goto out;
+	if (n <= 0 || n > CPU_COUNT_S(setsz, online)) {
+		fprintf(stderr, "spread: N must be 1..%d (the # of online CPUs)\n",
+			CPU_COUNT_S(setsz, online));
+		goto out;
+	}
+	node = calloc(numcores * 6, sizeof(int));
+	if (!node) {
+		perror("calloc");
+		goto out;
 	}
+	llc = node + numcores;
+	core = llc + numcores;
+	nnode = core + numcores;	/* # chosen, indexed by node / llc id / core id */
+	nllc = nnode + numcores;
+	ncore = nllc + numcores;
 
-	if (sched_setaffinity(pid, sizeof(cpu_set_t), &cpumask) < 0) {
-		perror("sched_setaffinity() failed");
+	for (i = 0; i < numcores; i++) {
+		if (!CPU_ISSET_S(i, setsz, online))
+			continue;
+		node[i] = cpu_to_node(i);
+		if (node[i] >= numcores)
+			node[i] = 0;
+		llc[i] = topo_llc(i, tmp) < 0 ? i : first_cpu(tmp);
+		core[i] = topo_core(i, tmp) < 0 ? i : first_cpu(tmp);
+	}
+
+	CPU_ZERO_S(setsz, set);
+	for (k = 0; k < n; k++) {
+		best = -1;
+		bestscore = LONG_MAX;
+		for (i = 0; i < numcores; i++) {
+			if (!CPU_ISSET_S(i, setsz, online) || CPU_ISSET_S(i, setsz, set))
+				continue;
+			score = ((long)nnode[node[i]] * numcores + nllc[llc[i]]) * numcores
+				+ ncore[core[i]];
+			if (score < bestscore) {
+				bestscore = score;
+				best = i;
+			}
+		}
+		CPU_SET_S(best, setsz, set);
+		nnode[node[best]]++;
+		nllc[llc[best]]++;
+		ncore[core[best]]++;
+	}
+	free(node);
+	ret = 0;
+ out:
+	CPU_FREE(online);
+	CPU_FREE(tmp);
+	return ret;
+}
+
+/* Compute the mask for the -t @spec (core|llc|node|spread:N) around @refcpu */
+static int topo_mask(const char *spec, int refcpu, cpu_set_t *set)
+{
+	int ret = -1;
+
+	if (!strcmp(spec, "core"))
+		ret = topo_core(refcpu, set);
+	else if (!strcmp(spec, "llc"))
+		ret = topo_llc(refcpu, set);
+	else if (!strcmp(spec, "node"))
+		ret = topo_node(refcpu, set);
+	else if (!strncmp(spec, "spread:", 7))
+		ret = topo_spread(atoi(spec + 7), set);
+	else
+		fprintf(stderr, "unknown topology placement '%s'\n", spec);
+	if (!ret) {
+		printf("Placement '%s' (reference CPU %d): ", spec, refcpu);
+		print_cpulist(set);
+		printf("\n");
+	}
+	return ret;
+}
+
+/*----------------------------------------------------------------------*/
+static int set_cpu_affinity(pid_t pid, cpu_set_t *cpumask, int all_threads)
+{
+	char path[64];
+	struct dirent *de;
+	int n = 0, ret = 0;
+	DIR *dir;
+
+	if (!all_threads) {
+		printf("\nSetting CPU affinity mask for PID %d now...\n", pid);
+		if (sched_setaffinity(pid, setsz, cpumask) < 0) {
+			perror("sched_setaffinity() failed");
+			return -1;
+		}
+		return query_cpu_affinity(pid);
+	}
+
+	printf("\nSetting CPU affinity mask for all threads of PID %d now...\n", pid);
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+	dir = opendir(path);
+	if (!dir) {
+		perror("opendir");
 		return -1;
 	}
-	disp_cpumask(pid, &cpumask, numcores);
+	while ((de = readdir(dir))) {
+		if (!isdigit((unsigned char)de->d_name[0]))
+			continue;
+		if (sched_setaffinity(atoi(de->d_name), setsz, cpumask) < 0) {
+			fprintf(stderr, "TID %s: ", de->d_name);
+			perror("sched_setaffinity() failed");
+			ret = -1;
+			continue;
+		}
+		n++;
+	}
+	closedir(dir);
+	printf("set on %d thread(s)\n", n);
+	query_cpu_affinity(pid);
 
-	return 0;
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-a] [-c cpulist | -t placement [-r refcpu]] [PID] [new-CPU-mask]\n"
+	"(If using the optional params, you must at least pass"
+	" the process PID;\nwe (attempt to) set CPU affinity only if"
+	" new-CPU-mask, -c or -t is passed)\n"
+	" new-CPU-mask : a (hex or decimal) bitmask of the first 64 CPUs\n"
+	" -c cpulist   : the new mask as a cpulist, f.e. 0-7,16-23\n"
+	" -t placement : compute the new mask from the CPU topology:\n"
+	"     core|llc|node : the reference CPU's core / LLC / NUMA node\n"
+	"     spread:N      : N CPUs spread across nodes, LLCs and cores\n"
+	" -r refcpu    : the reference CPU for -t (default: the current one)\n"
+	" -a           : apply the new mask to all threads of PID\n", name);
 }
 
 int main (int argc, char **argv)
 {
-	FILE *fp;
-	char s[9];
 	pid_t pid = getpid();
-	unsigned long new_cpumask = 0x0;
+	cpu_set_t *new_cpumask = NULL;
+	char *cpulist = NULL, *placement = NULL;
+	int opt, refcpu = -1, all_threads = 0, i;
+	unsigned long bitmask;
 
-	if (argc > 1 && 
-		((!strncmp(argv[1], "--help", 6)) || (!strncmp(argv[1], "-h", 2)))) {
-		fprintf(stderr, "Usage: %s [PID] [new-CPU-mask]\n"
-		"(If using the optional params, you must at least pass"
-		" the process PID;\nwe (attempt to) set CPU affinity only if"
-		" new-CPU-mask is passed)\n", argv[0]);
-		exit(EXIT_SUCCESS);
+	while ((opt = getopt(argc, argv, "ac:t:r:h")) != -1) {
+		switch (opt) {
+		case 'a':
+			all_threads = 1;
+			break;
+		case 'c':
+			cpulist = optarg;
+			break;
+		case 't':
+			placement = optarg;
+			break;
+		case 'r':
+			refcpu = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
 	}
-
-	fp = popen("nproc", "r");
-	if (!fp) {
-		fprintf(stderr, "%s: popen failed; can't detect # cores, aborting...\n", argv[0]);
+	if (cpulist && placement) {
+		fprintf(stderr, "%s: pass either -c or -t, not both\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
-	if (!fgets(s, sizeof(s), fp)) {
-		fprintf(stderr, "%s: fgets failed to read data; can't detect # cores, aborting...\n", argv[0]);
+
+	/* # of possible CPUs (not just the online ones); our masks span them all */
+	numcores = sysconf(_SC_NPROCESSORS_CONF);
+	if ((int)numcores <= 0) {
+		fprintf(stderr, "%s: can't detect # cores, aborting...\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
-	numcores = atoi(s);
+	setsz = CPU_ALLOC_SIZE(numcores);
 	printf("Detected %d CPU cores [for this process %s:%d]\n", numcores, argv[0], getpid());
 
-	if (argc >= 2)
-		pid = atoi(argv[1]);
+	if (optind < argc)
+		pid = atoi(argv[optind]);
 
-	query_cpu_affinity(pid);
-	if (argc == 3) {
-		new_cpumask = strtoul(argv[2], 0, 0);
-		set_cpu_affinity(pid, new_cpumask);
+	if (query_cpu_affinity(pid) < 0)
+		exit(EXIT_FAILURE);
+
+	if (cpulist) {
+		new_cpumask = cpuset_alloc();
+		if (parse_cpulist(cpulist, new_cpumask) < 0) {
+			fprintf(stderr, "%s: invalid cpulist '%s'\n", argv[0], cpulist);
+			exit(EXIT_FAILURE);
+		}
+	} else if (placement) {
+		if (refcpu < 0)
+			refcpu = sched_getcpu();
+		if (refcpu < 0 || refcpu >= numcores) {
+			fprintf(stderr, "%s: invalid reference CPU %d\n", argv[0], refcpu);
+			exit(EXIT_FAILURE);
+		}
+		new_cpumask = cpuset_alloc();
+		if (topo_mask(placement, refcpu, new_cpumask) < 0)
+			exit(EXIT_FAILURE);
+	} else if (optind + 1 < argc) {	/* the legacy bitmask */
+		bitmask = strtoul(argv[optind + 1], 0, 0);
+		new_cpumask = cpuset_alloc();
+		/* Iterate over the given bitmask, setting CPU bits as required */
+		for (i=0; i<sizeof(unsigned long)*8 && i<numcores; i++) {
+			if ((bitmask >> i) & 1)
+				CPU_SET_S(i, setsz, new_cpumask);
+		}
+	}
+
+	if (new_cpumask) {
+		if (set_cpu_affinity(pid, new_cpumask, all_threads) < 0)
+			exit(EXIT_FAILURE);
+		CPU_FREE(new_cpumask);
 	}
 
 	exit(EXIT_SUCCESS);
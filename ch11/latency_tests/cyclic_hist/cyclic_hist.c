@@ -0,0 +1,429 @@
+/*
+ * ch11/latency_tests/cyclic_hist/cyclic_hist.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 11 : CPU Scheduling, Part 2
+ ****************************************************************
+ * Brief Description:
+ * Analyse the histogram output of cyclictest (run with -h<N> -q, as our
+ * latency_test.sh does) in a single streaming pass - instead of the several
+ * grep|tr|sort passes plus a cut per core that the script performs, which,
+ * on multi-hour captures, takes minutes.
+ * We report, per core and merged over all cores, the # of samples, min, avg
+ * and max latency, the 50/90/99/99.9/99.99 percentiles and the # of histogram
+ * overflows (samples beyond the histogram's range).
+ *
+ * Usage: cyclic_hist [-m] [-g prefix] output-file [output-file2]
+ *  -m        : machine-readable summary; one line per core (and one for
+ *              'all') of key=value pairs, f.e. for eval in a shell script
+ *  -g prefix : also write gnuplot-ready data: <prefix>1 .. <prefix>N, two
+ *              column (latency, count) files, one per core (as the script's
+ *              histogramN files), and <prefix>.all, the merged histogram
+ *  With two files, we diff the runs: both runs' stats, side by side, with
+ *  the change.
+ * Pass '-' as the file to read stdin (so you can pipe cyclictest into us).
+ *
+ * For details, refer the book, Ch 11.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#define MAXCORES	4096
+#define NPCT		5
+
+static const double pcts[NPCT] = { 50, 90, 99, 99.9, 99.99 };
+static const char *pct_key[NPCT] = { "p50", "p90", "p99", "p999", "p9999" };
+
+struct core_stats {
+	uint64_t samples, overflows;
+	long min, max;		/* -1 if unknown */
+	double avg;
+	long pct[NPCT];
+};
+
+struct run {
+	const char *fname;
+	int ncores;
+	long nrows;		/* histogram rows (latency values 0..nrows-1) */
+	uint64_t *hist;		/* [row * ncores + core] */
+	/* as reported by cyclictest itself in it's trailer, if present */
+	long rep_min[MAXCORES], rep_max[MAXCORES], rep_ovf[MAXCORES];
+	double rep_avg[MAXCORES];
+	int have_min, have_avg, have_max, have_ovf;
+	struct core_stats *st;	/* [ncores + 1]: the last one is 'all' */
+};
+
+/* Parse up to MAXCORES numbers following the ':' of a trailer line into @out */
+static int parse_trailer_longs(const char *s, long *out)
+{
+	char *end;
+	int n = 0;
+
+	s = strchr(s, ':');
+	if (!s)
+		return 0;
+	for (s++; n < MAXCORES; n++) {
+		out[n] = strtol(s, &end, 10);
+		if (end == s)
+			break;
+		s = end;
+	}
+	return n;
+}
+
+static int parse_trailer_doubles(const char *s, double *out)
+{
+	char *end;
+	int n = 0;
+
+	s = strchr(s, ':');
+	if (!s)
+		return 0;
+	for (s++; n < MAXCORES; n++) {
+		out[n] = strtod(s, &end);
+		if (end == s)
+			break;
+		s = end;
+	}
+	return n;
+}
+
+/* The single pass over cyclictest's output */
+static int read_run(struct run *r)
+{
+	FILE *fp = strcmp(r->fname, "-") ? fopen(r->fname, "r") : stdin;
+	long lat, capacity = 0, cnt;
+	char *line = NULL, *s, *end;
+	size_t len = 0;
+	int core;
+
+	if (!fp) {
+		perror(r->fname);
+		return -1;
+	}
+	while (getline(&line, &len, fp) > 0) {
+		if (line[0] == '#') {
+			if (strstr(line, "Min Latencies"))
+				r->have_min = parse_trailer_longs(line, r->rep_min);
+			else if (strstr(line, "Avg Latencies"))
+				r->have_avg = parse_trailer_doubles(line, r->rep_avg);
+			else if (strstr(line, "Max Latencies"))
+				r->have_max = parse_trailer_longs(line, r->rep_max);
+			else if (strstr(line, "Histogram Overflows"))
+				r->have_ovf = parse_trailer_longs(line, r->rep_ovf);
+			continue;
+		}
+		/* a data line: 'latency count0 count1 ...' */
+		lat = strtol(line, &end, 10);
+		if (end == line || lat < 0)
+			continue;
+		if (!r->ncores) {	/* the first data line tells us the # of cores */
+			for (s = end; ; s = end) {
+				strtoull(s, &end, 10);
+				if (end == s)
+					break;
+				r->ncores++;
+			}
+			if (!r->ncores || r->ncores > MAXCORES) {
+				fprintf(stderr, "%s: bad data line: %s", r->fname, line);
+				return -1;
+			}
+		}
+		if (lat >= capacity) {
+			long newcap = capacity ? capacity : 1024;
+
+			while (lat >= newcap)
+				newcap *= 2;
+			r->hist = realloc(r->hist, newcap * r->ncores * sizeof(uint64_t));
+			if (!r->hist) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+			memset(r->hist + capacity * r->ncores, 0,
+			       (newcap - capacity) * r->ncores * sizeof(uint64_t));
+			capacity = newcap;
+		}
+		for (s = end, core = 0; core < r->ncores; core++, s = end) {
+			cnt = strtoull(s, &end, 10);
+			if (end == s)
+				break;
+			r->hist[lat * r->ncores + core] += cnt;
+		}
+		if (lat >= r->nrows)
+			r->nrows = lat + 1;
+	}
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	if (!r->ncores) {
+		fprintf(stderr, "%s: no histogram data found (was cyclictest run with -h?)\n",
+			r->fname);
+		return -1;
+	}
+	return 0;
+}
+
+/* Compute the stats of core @c (or, if @c == ncores, of all of them merged) */
+static void compute_stats(struct run *r, int c, struct core_stats *st)
+{
+	uint64_t n, cum, target[NPCT];
+	double sum = 0;
+	long lat;
+	int core, p;
+
+	memset(st, 0, sizeof(*st));
+	st->min = st->max = -1;
+	for (lat = 0; lat < r->nrows; lat++) {
+		for (core = 0; core < r->ncores; core++) {
+			if (c != r->ncores && core != c)
+				continue;
+			n = r->hist[lat * r->ncores + core];
+			if (!n)
+				continue;
+			if (st->min < 0)
+				st->min = lat;
+			st->max = lat;
+			st->samples += n;
+			sum += (double)n * lat;
+		}
+	}
+	if (st->samples)
+		st->avg = sum / st->samples;
+
+	/* percentiles: a second walk, over the (small) histogram - not the input */
+	for (p = 0; p < NPCT; p++) {
+		target[p] = (uint64_t)(st->samples * pcts[p] / 100.0 + 0.5);
+		if (!target[p])
+			target[p] = 1;
+		st->pct[p] = -1;
+	}
+	for (lat = 0, cum = 0, p = 0; lat < r->nrows && p < NPCT; lat++) {
+		for (core = 0; core < r->ncores; core++)
+			if (c == r->ncores || core == c)
+				cum += r->hist[lat * r->ncores + core];
+		while (p < NPCT && cum >= target[p] && st->samples)
+			st->pct[p++] = lat;
+	}
+
+	/* prefer cyclictest's own figures: they include out-of-histogram samples */
+	if (c < r->ncores) {
+		if (c < r->have_min)
+			st->min = r->rep_min[c];
+		if (c < r->have_avg)
+			st->avg = r->rep_avg[c];
+		if (c < r->have_max)
+			st->max = r->rep_max[c];
+		if (c < r->have_ovf)
+			st->overflows = r->rep_ovf[c];
+	} else {
+		for (core = 0; core < r->ncores; core++) {
+			if (core < r->have_min && (st->min < 0 || r->rep_min[core] < st->min))
+				st->min = r->rep_min[core];
+			if (core < r->have_max && r->rep_max[core] > st->max)
+				st->max = r->rep_max[core];
+			if (core < r->have_ovf)
+				st->overflows += r->rep_ovf[core];
+		}
+		if (r->have_avg == r->ncores) {	/* sample-weighted mean of the core avgs */
+			sum = 0;
+			for (core = 0; core < r->ncores; core++)
+				sum += r->rep_avg[core] * r->st[core].samples;
+			if (st->samples)
+				st->avg = sum / st->samples;
+		}
+	}
+}
+
+static void analyse(struct run *r)
+{
+	int c;
+
+	r->st = calloc(r->ncores + 1, sizeof(struct core_stats));
+	if (!r->st) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	for (c = 0; c <= r->ncores; c++)	/* 'all' last: it uses the per core ones */
+		compute_stats(r, c, &r->st[c]);
+}
+
+static void core_name(const struct run *r, int c, char *buf, size_t len)
+{
+	if (c == r->ncores)
+		snprintf(buf, len, "all");
+	else
+		snprintf(buf, len, "%d", c);
+}
+
+static void print_human(const struct run *r)
+{
+	char who[16];
+	int c, p;
+
+	printf("%s: %d cores, latency (us)\n", r->fname, r->ncores);
+	printf("%-5s %14s %6s %9s %7s", "core", "samples", "min", "avg", "max");
+	for (p = 0; p < NPCT; p++)
+		printf(" %6g%%", pcts[p]);
+	printf(" %9s\n", "overflows");
+	for (c = 0; c <= r->ncores; c++) {
+		const struct core_stats *st = &r->st[c];
+
+		core_name(r, c, who, sizeof(who));
+		printf("%-5s %14llu %6ld %9.2f %7ld", who, (unsigned long long)st->samples,
+		       st->min, st->avg, st->max);
+		for (p = 0; p < NPCT; p++)
+			printf(" %7ld", st->pct[p]);
+		printf(" %9llu\n", (unsigned long long)st->overflows);
+	}
+}
+
+static void print_machine(const struct run *r)
+{
+	char who[16];
+	int c, p;
+
+	for (c = 0; c <= r->ncores; c++) {
+		const struct core_stats *st = &r->st[c];
+
+		core_name(r, c, who, sizeof(who));
+		printf("core=%s samples=%llu min=%ld avg=%.2f max=%ld", who,
+		       (unsigned long long)st->samples, st->min, st->avg, st->max);
+		for (p = 0; p < NPCT; p++)
+			printf(" %s=%ld", pct_key[p], st->pct[p]);
+		printf(" overflows=%llu\n", (unsigned long long)st->overflows);
+	}
+}
+
+/* Write <prefix>1 .. <prefix>N (1-based, as latency_test.sh does) and <prefix>.all */
+static int write_gnuplot(const struct run *r, const char *prefix)
+{
+	char fname[4096];
+	uint64_t n;
+	long lat;
+	int c, core;
+	FILE *fp;
+
+	for (c = 0; c <= r->ncores; c++) {
+		if (c == r->ncores)
+			snprintf(fname, sizeof(fname), "%s.all", prefix);
+		else
+			snprintf(fname, sizeof(fname), "%s%d", prefix, c + 1);
+		fp = fopen(fname, "w");
+		if (!fp) {
+			perror(fname);
+			return -1;
+		}
+		for (lat = 0; lat < r->nrows; lat++) {
+			n = 0;
+			for (core = 0; core < r->ncores; core++)
+				if (c == r->ncores || core == c)
+					n += r->hist[lat * r->ncores + core];
+			fprintf(fp, "%ld\t%llu\n", lat, (unsigned long long)n);
+		}
+		fclose(fp);
+	}
+	return 0;
+}
+
+static void diff_line(const char *what, double a, double b)
+{
+	printf("  %-10s %12.2f %12.2f %+12.2f", what, a, b, b - a);
+	if (a)
+		printf(" (%+.1f%%)", (b - a) * 100.0 / a);
+	printf("\n");
+}
+
+static void print_diff(const struct run *a, const struct run *b)
+{
+	int c, p, ncores = a->ncores < b->ncores ? a->ncores : b->ncores;
+	char who[16];
+
+	if (a->ncores != b->ncores)
+		printf("(warning: the runs have %d and %d cores; comparing %d)\n",
+		       a->ncores, b->ncores, ncores);
+	printf("latency (us)  %12s %12s %12s\n", "run1", "run2", "change");
+	for (c = 0; c <= ncores; c++) {
+		/* compare like with like: 'all' vs 'all' */
+		const struct core_stats *x = &a->st[c == ncores ? a->ncores : c];
+		const struct core_stats *y = &b->st[c == ncores ? b->ncores : c];
+
+		core_name(a, c == ncores ? a->ncores : c, who, sizeof(who));
+		printf("core %s:\n", who);
+		diff_line("samples", x->samples, y->samples);
+		diff_line("min", x->min, y->min);
+		diff_line("avg", x->avg, y->avg);
+		diff_line("max", x->max, y->max);
+		for (p = 0; p < NPCT; p++)
+			diff_line(pct_key[p], x->pct[p], y->pct[p]);
+		diff_line("overflows", x->overflows, y->overflows);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-m] [-g prefix] output-file [output-file2]\n"
+		" -m        : machine-readable (key=value) summary\n"
+		" -g prefix : write gnuplot-ready data files <prefix>1..N and <prefix>.all\n"
+		" with two files, diff the two runs; '-' reads stdin\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	struct run runs[2];
+	char *prefix = NULL;
+	int opt, machine = 0, nruns, i;
+
+	while ((opt = getopt(argc, argv, "mg:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			machine = 1;
+			break;
+		case 'g':
+			prefix = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+	nruns = argc - optind;
+	if (nruns < 1 || nruns > 2) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(runs, 0, sizeof(runs));
+	for (i = 0; i < nruns; i++) {
+		runs[i].fname = argv[optind + i];
+		if (read_run(&runs[i]) < 0)
+			exit(EXIT_FAILURE);
+		analyse(&runs[i]);
+	}
+
+	if (nruns == 2)
+		print_diff(&runs[0], &runs[1]);
+	else if (machine)
+		print_machine(&runs[0]);
+	else
+		print_human(&runs[0]);
+
+	if (prefix && write_gnuplot(&runs[0], prefix) < 0)
+		exit(EXIT_FAILURE);
+
+	for (i = 0; i < nruns; i++) {
+		free(runs[i].hist);
+		free(runs[i].st);
+	}
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,186 @@
+/*
+ * ch11/latency_tests/hrtimer_lat/hrtimer_lat.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 11 : CPU Scheduling, Part 2
+ ****************************************************************
+ * Brief Description:
+ * An in-kernel, cyclictest-like wakeup latency tester: no rt-tests package
+ * required. We run one SCHED_FIFO kthread bound to each online CPU; each of
+ * them repeatedly sleeps on an hrtimer armed for an absolute expiry 'interval_us'
+ * microseconds in the future, and on wakeup records the latency - how late
+ * (in ns) it actually got to run - into our klib_llkd timing histogram
+ * (llkd_hist: per-CPU and log-linear, i.e., ~6% resolution at any magnitude).
+ * The results are exposed via debugfs, under /sys/kernel/debug/hrtimer_lat/ :
+ *  summary   : per CPU and merged samples, min/avg/max and percentiles
+ *  histogram : the full histograms, one row per (non-empty) bucket: the
+ *              bucket's lower bound (ns) followed by each CPU's count -
+ *              gnuplot-ready, as with the histogramN files latency_test.sh
+ *              generates
+ *  reset     : write anything to it to clear all the statistics
+ * Usage f.e.:
+ *  sudo insmod ./hrtimer_lat_lkm.ko interval_us=200 duration_s=60
+ *  (run your load...)
+ *  sudo cat /sys/kernel/debug/hrtimer_lat/summary
+ *
+ * For details, please refer the book, Ch 11.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/cpumask.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 9, 0)
+#include <uapi/linux/sched/types.h>	/* struct sched_param */
+#endif
+#include "../../../klib_llkd.h"
+
+#define OURMODNAME   "hrtimer_lat"
+
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_DESCRIPTION("LKP book:ch11/latency_tests/hrtimer_lat: in-kernel hrtimer wakeup latency histograms");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static uint interval_us = 200;
+module_param(interval_us, uint, 0444);
+MODULE_PARM_DESC(interval_us, "the hrtimer (wakeup) interval, in microseconds (default=200)");
+
+static uint duration_s;
+module_param(duration_s, uint, 0444);
+MODULE_PARM_DESC(duration_s, "stop sampling after these many seconds (default=0: run until unloaded)");
+
+static uint rtprio = 90;
+module_param(rtprio, uint, 0444);
+MODULE_PARM_DESC(rtprio,
+"SCHED_FIFO priority of our kthreads (default=90; on 5.9 and later kernels, the kernel's sched_set_fifo() default is used instead)");
+
+static struct llkd_hist *lat;
+static struct task_struct **tsk;	/* nr_cpu_ids entries */
+
+/* Our per-CPU kthread: sleep on an hrtimer, record how late we wake up, repeat */
+static int lat_thread(void *arg)
+{
+	ktime_t next, now, interval = us_to_ktime(interval_us);
+	u64 end_ns = duration_s ? ktime_get_ns() + (u64)duration_s * NSEC_PER_SEC : 0;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	sched_set_fifo(current);
+#else
+	{
+		struct sched_param param = { .sched_priority = rtprio };
+
+		sched_setscheduler_nocheck(current, SCHED_FIFO, &param);
+	}
+#endif
+	pr_debug("kthread PID %d on cpu %d sampling now\n", current->pid, smp_processor_id());
+
+	next = ktime_add(ktime_get(), interval);
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		schedule_hrtimeout_range(&next, 0, HRTIMER_MODE_ABS);
+		now = ktime_get();
+		llkd_hist_record(lat, ktime_to_ns(ktime_sub(now, next)));
+
+		if (end_ns && ktime_to_ns(now) >= end_ns)
+			break;
+		/* as cyclictest does, stay on the original grid; skip missed periods */
+		next = ktime_add(next, interval);
+		if (ktime_before(next, now))
+			next = ktime_add(now, interval);
+	}
+
+	/* done sampling (duration_s elapsed); wait to be stopped */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static void stop_threads(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (tsk[cpu]) {
+			kthread_stop(tsk[cpu]);
+			put_task_struct(tsk[cpu]);
+			tsk[cpu] = NULL;
+		}
+	}
+}
+
+static int __init hrtimer_lat_init(void)
+{
+	struct task_struct *t;
+	int cpu, ret = -ENOMEM;
+
+	if (!interval_us) {
+		pr_warn("interval_us must be > 0\n");
+		return -EINVAL;
+	}
+	/* our summary, histogram and reset files: /sys/kernel/debug/hrtimer_lat/ */
+	lat = llkd_hist_create(OURMODNAME, NULL);
+	if (!lat)
+		return -ENOMEM;
+	tsk = kcalloc(nr_cpu_ids, sizeof(struct task_struct *), GFP_KERNEL);
+	if (!tsk)
+		goto out_hist;
+
+	/* (CPUs coming online later aren't covered) */
+	cpus_read_lock();
+	for_each_online_cpu(cpu) {
+		t = kthread_create_on_node(lat_thread, NULL, cpu_to_node(cpu), "%s/%d",
+					   OURMODNAME, cpu);
+		if (IS_ERR(t)) {
+			ret = PTR_ERR(t);
+			cpus_read_unlock();
+			goto out_threads;
+		}
+		kthread_bind(t, cpu);
+		get_task_struct(t);	/* so that kthread_stop() is safe even if it's exited */
+		tsk[cpu] = t;
+		wake_up_process(t);
+	}
+	cpus_read_unlock();
+
+	pr_info("sampling every %u us on %u CPUs%s; see /sys/kernel/debug/%s/\n",
+		interval_us, num_online_cpus(), duration_s ? " (for a limited duration)" : "",
+		OURMODNAME);
+	return 0;		/* success */
+
+out_threads:
+	stop_threads();
+	kfree(tsk);
+out_hist:
+	llkd_hist_destroy(lat);
+	return ret;
+}
+
+static void __exit hrtimer_lat_exit(void)
+{
+	stop_threads();
+	kfree(tsk);
+	llkd_hist_log(lat);
+	llkd_hist_destroy(lat);
+	pr_info("removed\n");
+}
+
+module_init(hrtimer_lat_init);
+module_exit(hrtimer_lat_exit);
@@ -19,6 +19,9 @@
 # b) Detailed slides on cyclictest, good for understanding latency and it's
 # measurement: 'Using and Understanding the Real-Time Cyclictest Benchmark',
 # Rowand, Oct 2013: https://events.static.linuxfound.org/sites/events/files/slides/cyclictest.pdf
+# c) No rt-tests (cyclictest) on the target? Our hrtimer_lat/ kernel module
+# measures (per-CPU) hrtimer wakeup latency in-kernel, with the histograms
+# available via debugfs.
 name=$(basename $0)
 
 [ $# -ne 1 ] && {
@@ -57,28 +60,38 @@ duration=1h
 echo "sudo ${pfx}cyclictest --duration=${duration} -m -Sp90 -i200 -h400 -q >output"
 sudo ${pfx}cyclictest --duration=${duration} -m -Sp90 -i200 -h400 -q >output
 
-# 2. Get maximum latency
-min=$(grep "Min Latencies" output | tr " " "\n" | grep "^[0-9]" | sort -n | head -1 | sed s/^0*//)
-max=$(grep "Max Latencies" output | tr " " "\n" | sort -n | tail -1 | sed s/^0*//)
-avg=$(grep "Avg Latencies" output | tr " " "\n" | grep "^[0-9]" | sed s/^0*// |awk '{sum += $1} END {print sum/NR}')
-latstr="min/avg/max latency: ${min} us / ${avg} us / ${max} us"
-echo "${latstr}"
-
-# 3. Grep data lines, remove empty lines and create a common field separator
-grep -v -e "^#" -e "^$" output | tr " " "\t" >histogram 
-
 # 4. Set the number of cores, for example
 #cores=4
 # (If the script is used on a variety of systems with a different number of cores,
 # this can, of course, be determined from the system.)
 cores=$(nproc)
 
-# 5. Create two-column data sets with latency classes and frequency values for each core
-for i in $(seq 1 $cores)
-do
-    column=`expr $i + 1`
-    cut -f1,$column histogram >histogram$i
-done
+# Our cyclic_hist tool (in cyclic_hist/; build it with 'make') does steps 2, 3
+# and 5 below in a single pass over the output - much faster on long captures.
+CYCLIC_HIST=$(dirname $0)/cyclic_hist/cyclic_hist
+if [ -x ${CYCLIC_HIST} ] ; then
+  # sets samples, min, avg, max, p50, p90, p99, p999, p9999 and overflows
+  eval $(${CYCLIC_HIST} -m -g histogram output | grep "^core=all" | sed 's/^core=all //')
+  latstr="min/avg/max latency: ${min} us / ${avg} us / ${max} us"
+  echo "${latstr} (p99 ${p99} us, p99.99 ${p9999} us)"
+else
+  # 2. Get maximum latency
+  min=$(grep "Min Latencies" output | tr " " "\n" | grep "^[0-9]" | sort -n | head -1 | sed s/^0*//)
+  max=$(grep "Max Latencies" output | tr " " "\n" | sort -n | tail -1 | sed s/^0*//)
+  avg=$(grep "Avg Latencies" output | tr " " "\n" | grep "^[0-9]" | sed s/^0*// |awk '{sum += $1} END {print sum/NR}')
+  latstr="min/avg/max latency: ${min} us / ${avg} us / ${max} us"
+  echo "${latstr}"
+
+  # 3. Grep data lines, remove empty lines and create a common field separator
+  grep -v -e "^#" -e "^$" output | tr " " "\t" >histogram 
+
+  # 5. Create two-column data sets with latency classes and frequency values for each core
+  for i in $(seq 1 $cores)
+  do
+      column=`expr $i + 1`
+      cut -f1,$column histogram >histogram$i
+  done
+fi
 
 # 6. Create plot command header
 title="${title}: ${latstr} ; kernel: $(uname -r)"
@@ -0,0 +1,327 @@
+/*
+ * ch11/sched_periodic/sched_periodic.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 11 : CPU Scheduling, Part 2
+ ****************************************************************
+ * Brief Description:
+ * A *userspace* periodic task - think of a control loop - run, in turn, under
+ * each of the SCHED_DEADLINE, SCHED_FIFO and SCHED_OTHER policies, so that we
+ * can compare how well each meets it's timing requirements. (The
+ * sched_periodic_kthread LKM here does the same within the kernel.)
+ *
+ * Each job k is released at start + k * period; it then burns 'work' us of
+ * CPU (via convenient.h's lkp_burn_*(), a busy loop calibrated at startup)
+ * and must complete within 'deadline' us of it's release. Per policy, we
+ * report:
+ *  - the response time (release to completion) percentiles
+ *  - deadline misses : jobs completing after release + deadline
+ *  - overruns        : jobs still running at the next job's release (so the
+ *                      next one starts late)
+ *  - for SCHED_DEADLINE, how often we got throttled: the reservation's
+ *    'runtime' (-R) is what the kernel guarantees - and enforces - per period;
+ *    set -w > -R to watch the CBS throttle the task
+ * To make things interesting, run some competing load: -b N starts N
+ * SCHED_OTHER CPU hog threads alongside.
+ *
+ * Usage: sudo ./sched_periodic [-P policies] [-p period-us] [-d deadline-us]
+ *            [-R runtime-us] [-w work-us] [-n jobs] [-b hogs]
+ *
+ * For details, please refer the book, Ch 11.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "../../convenient.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE		6
+#endif
+
+/* Our own copy of the kernel's struct sched_attr (older glibc's lack it) */
+struct llkd_sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;		/* SCHED_DEADLINE (ns) */
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+static struct {
+	long period_us, deadline_us, runtime_us, work_us, njobs;
+	int nhogs, fifo_prio;
+} cfg = { 10000, 0, 0, 2000, 1000, 0, 80 };
+
+static volatile int stop_hogs;
+
+static inline uint64_t now_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *hog(void *arg)
+{
+	while (!stop_hogs)
+		lkp_burn_us(1000);
+	return NULL;
+}
+
+static int set_policy(int policy)
+{
+	struct llkd_sched_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_policy = policy;
+	switch (policy) {
+	case SCHED_DEADLINE:
+		attr.sched_runtime = cfg.runtime_us * 1000ULL;
+		attr.sched_deadline = cfg.deadline_us * 1000ULL;
+		attr.sched_period = cfg.period_us * 1000ULL;
+		break;
+	case SCHED_FIFO:
+		attr.sched_priority = cfg.fifo_prio;
+		break;
+	}
+	return syscall(SYS_sched_setattr, 0, &attr, 0);
+}
+
+struct result {
+	const char *name;
+	int policy, failed;
+	uint64_t *resp;		/* response time per job (ns) */
+	long misses, overruns, throttled;
+};
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The periodic task itself; a thread, so that it's policy is it's own */
+static void *periodic(void *arg)
+{
+	struct result *res = arg;
+	uint64_t start, release, next, done, wall1, cpu1, cpu2;
+	int64_t offcpu;
+	struct timespec ts;
+	long k;
+
+	if (set_policy(res->policy) < 0) {
+		fprintf(stderr, "%s: sched_setattr() failed: %s%s\n", res->name, strerror(errno),
+			errno == EPERM ? " (need root)" :
+			errno == EBUSY ? " (admission control: runtime/period too high?)" : "");
+		res->failed = 1;
+		return NULL;
+	}
+
+	start = now_ns(CLOCK_MONOTONIC) + 10000000;	/* begin in 10 ms */
+	for (k = 0; k < cfg.njobs; k++) {
+		release = start + k * cfg.period_us * 1000ULL;
+		next = release + cfg.period_us * 1000ULL;
+		if (now_ns(CLOCK_MONOTONIC) < release) {
+			ts.tv_sec = release / 1000000000ULL;
+			ts.tv_nsec = release % 1000000000ULL;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		}
+		/* the job */
+		wall1 = now_ns(CLOCK_MONOTONIC);
+		cpu1 = now_ns(CLOCK_THREAD_CPUTIME_ID);
+		lkp_burn_us(cfg.work_us);
+		done = now_ns(CLOCK_MONOTONIC);
+		cpu2 = now_ns(CLOCK_THREAD_CPUTIME_ID);
+
+		res->resp[k] = done - release;
+		if (done > release + cfg.deadline_us * 1000ULL)
+			res->misses++;
+		if (done > next)
+			res->overruns++;
+		/*
+		 * Off-CPU for well over the job's own run time: we were kept
+		 * off it - for SCHED_DEADLINE with work > runtime, that's the CBS
+		 * throttling us; else, preemption by others. (Signed: the two
+		 * clocks' deltas differ by a little either way)
+		 */
+		offcpu = (int64_t)(done - wall1) - (int64_t)(cpu2 - cpu1);
+		if (offcpu > (int64_t)cfg.period_us * 1000 / 10)
+			res->throttled++;
+	}
+	return NULL;
+}
+
+/* The (sorted) @v's @pct percentile, in us */
+static double pctile(const uint64_t *v, long n, double pct)
+{
+	long idx = (long)(n * pct / 100.0);
+
+	if (idx >= n)
+		idx = n - 1;
+	return v[idx] / 1000.0;
+}
+
+static void report(struct result *res)
+{
+	uint64_t *r = res->resp;
+	long n = cfg.njobs;
+
+	if (res->failed) {
+		printf("%-15s : (couldn't run)\n", res->name);
+		return;
+	}
+	qsort(r, n, sizeof(uint64_t), cmp_u64);
+	printf("%-15s : %8.1f %8.1f %8.1f %9.1f %9.1f | %7ld %7ld %9ld\n", res->name,
+	       r[0] / 1e3, pctile(r, n, 50), pctile(r, n, 99), pctile(r, n, 99.9),
+	       r[n - 1] / 1e3, res->misses, res->overruns, res->throttled);
+}
+
+static int parse_policies(char *arg, struct result *res, int max)
+{
+	char *tok;
+	int n = 0;
+
+	for (tok = strtok(arg, ","); tok && n < max; tok = strtok(NULL, ",")) {
+		if (!strcasecmp(tok, "deadline") || !strcasecmp(tok, "dl")) {
+			res[n].name = "SCHED_DEADLINE";
+			res[n++].policy = SCHED_DEADLINE;
+		} else if (!strcasecmp(tok, "fifo")) {
+			res[n].name = "SCHED_FIFO";
+			res[n++].policy = SCHED_FIFO;
+		} else if (!strcasecmp(tok, "other") || !strcasecmp(tok, "normal")) {
+			res[n].name = "SCHED_OTHER";
+			res[n++].policy = SCHED_OTHER;
+		} else {
+			fprintf(stderr, "unknown policy '%s'\n", tok);
+			exit(EXIT_FAILURE);
+		}
+	}
+	return n;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-P policies] [-p period-us] [-d deadline-us] [-R runtime-us]\n"
+		"\t[-w work-us] [-n jobs] [-b hogs] [-f fifo-prio]\n"
+		" -P : comma separated; any of deadline,fifo,other (default: all three, in turn)\n"
+		" -p : period (default %ld us)\n"
+		" -d : relative deadline (default: the period)\n"
+		" -R : SCHED_DEADLINE runtime reservation (default: work + 10%%)\n"
+		" -w : CPU work per job (default %ld us)\n"
+		" -n : # of jobs (periods) per policy (default %ld)\n"
+		" -b : # of competing SCHED_OTHER CPU hog threads (default 0)\n"
+		" -f : SCHED_FIFO priority (default %d)\n",
+		name, cfg.period_us, cfg.work_us, cfg.njobs, cfg.fifo_prio);
+}
+
+int main(int argc, char **argv)
+{
+	struct result res[3];
+	char defpol[] = "deadline,fifo,other";
+	char *policies = defpol;
+	pthread_t *hogs = NULL, t;
+	int opt, npol, i;
+
+	memset(res, 0, sizeof(res));
+	while ((opt = getopt(argc, argv, "P:p:d:R:w:n:b:f:h")) != -1) {
+		switch (opt) {
+		case 'P':
+			policies = optarg;
+			break;
+		case 'p':
+			cfg.period_us = atol(optarg);
+			break;
+		case 'd':
+			cfg.deadline_us = atol(optarg);
+			break;
+		case 'R':
+			cfg.runtime_us = atol(optarg);
+			break;
+		case 'w':
+			cfg.work_us = atol(optarg);
+			break;
+		case 'n':
+			cfg.njobs = atol(optarg);
+			break;
+		case 'b':
+			cfg.nhogs = atoi(optarg);
+			break;
+		case 'f':
+			cfg.fifo_prio = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+	}
+	if (!cfg.deadline_us)
+		cfg.deadline_us = cfg.period_us;
+	if (!cfg.runtime_us)
+		cfg.runtime_us = cfg.work_us + cfg.work_us / 10;
+	if (cfg.period_us <= 0 || cfg.work_us < 0 || cfg.njobs <= 0 ||
+	    cfg.deadline_us > cfg.period_us || cfg.runtime_us > cfg.deadline_us) {
+		fprintf(stderr, "invalid parameters: need runtime <= deadline <= period\n");
+		exit(EXIT_FAILURE);
+	}
+	npol = parse_policies(policies, res, 3);
+
+	lkp_burn_calibrate();
+	printf("period %ld us, deadline %ld us, work %ld us (DL runtime %ld us), %ld jobs; "
+	       "%d hog(s); calibrated %.1f loops/us\n", cfg.period_us, cfg.deadline_us,
+	       cfg.work_us, cfg.runtime_us, cfg.njobs, cfg.nhogs, lkp_loops_per_ms / 1e3);
+
+	if (cfg.nhogs) {
+		hogs = calloc(cfg.nhogs, sizeof(pthread_t));
+		for (i = 0; hogs && i < cfg.nhogs; i++)
+			if (pthread_create(&hogs[i], NULL, hog, NULL)) {
+				perror("pthread_create");
+				exit(EXIT_FAILURE);
+			}
+	}
+
+	printf("\n%-15s   %-44s | %-7s %-7s %-9s\n", "", "    response time (us)",
+	       "dl", "", "throttled/");
+	printf("%-15s : %8s %8s %8s %9s %9s | %7s %7s %9s\n", "policy", "min", "p50", "p99",
+	       "p99.9", "max", "misses", "overrun", "preempted");
+	for (i = 0; i < npol; i++) {
+		res[i].resp = calloc(cfg.njobs, sizeof(uint64_t));
+		if (!res[i].resp) {
+			perror("calloc");
+			exit(EXIT_FAILURE);
+		}
+		/* a new thread per policy: a SCHED_DEADLINE task can't fork */
+		if (pthread_create(&t, NULL, periodic, &res[i])) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+		pthread_join(t, NULL);
+		report(&res[i]);
+		free(res[i].resp);
+	}
+
+	stop_hogs = 1;
+	for (i = 0; hogs && i < cfg.nhogs; i++)
+		pthread_join(hogs[i], NULL);
+	free(hogs);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,239 @@
+/*
+ * ch11/sched_periodic/sched_periodic_kthread.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 11 : CPU Scheduling, Part 2
+ ****************************************************************
+ * Brief Description:
+ * The kernel counterpart of the sched_periodic userspace app: a kthread that
+ * runs a periodic job - released every 'period_us', burning 'work_us' of CPU,
+ * to complete within 'deadline_us' of it's release - under each of the
+ * policies in 'policies' in turn (SCHED_DEADLINE, SCHED_FIFO and/or
+ * SCHED_OTHER, set via the kernel's sched_setattr_nocheck()), 'njobs' jobs
+ * each. For every policy, it logs the response time (release to completion)
+ * percentiles, the # of deadline misses and of overruns (a job still running
+ * at the next one's release).
+ * For SCHED_DEADLINE, 'runtime_us' is the CBS reservation: the CPU time the
+ * kernel guarantees - and enforces - per period; set work_us > runtime_us to
+ * see the task get throttled.
+ * Note: we don't bind the kthread to a CPU; the kernel refuses
+ * SCHED_DEADLINE to tasks whose affinity doesn't span their root domain.
+ *
+ * Usage f.e.:
+ *  sudo insmod ./sched_periodic_kthread.ko period_us=10000 work_us=3000
+ *  (run some load, wait for the 'done' message)
+ *  sudo dmesg
+ *
+ * For details, please refer the book, Ch 11.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/completion.h>
+#include <uapi/linux/sched/types.h>	/* struct sched_attr */
+#include "../../convenient.h"
+
+#define OURMODNAME   "sched_periodic"
+
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_DESCRIPTION("LKP book:ch11/sched_periodic: periodic kthread under SCHED_DEADLINE, FIFO and OTHER");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static char *policies = "deadline,fifo,other";
+module_param(policies, charp, 0444);
+MODULE_PARM_DESC(policies,
+"comma separated policies to run the periodic task under, in turn; any of deadline,fifo,other (default: all three)");
+
+static uint period_us = 10000;
+module_param(period_us, uint, 0444);
+MODULE_PARM_DESC(period_us, "the job release period, in microseconds (default=10000)");
+
+static uint deadline_us;
+module_param(deadline_us, uint, 0444);
+MODULE_PARM_DESC(deadline_us, "the relative deadline, in microseconds (default=0: the period)");
+
+static uint runtime_us;
+module_param(runtime_us, uint, 0444);
+MODULE_PARM_DESC(runtime_us, "the SCHED_DEADLINE runtime reservation, in microseconds (default=0: work_us + 10%)");
+
+static uint work_us = 2000;
+module_param(work_us, uint, 0444);
+MODULE_PARM_DESC(work_us, "the CPU work done per job, in microseconds (default=2000)");
+
+static uint njobs = 1000;
+module_param(njobs, uint, 0444);
+MODULE_PARM_DESC(njobs, "the # of jobs (periods) to run under each policy (default=1000)");
+
+static struct task_struct *tsk;
+static DECLARE_COMPLETION(done);
+static u64 *resp;		/* response time per job (ns) */
+
+static int set_policy(int policy)
+{
+	struct sched_attr attr = {
+		.size = sizeof(struct sched_attr),
+		.sched_policy = policy,
+	};
+
+	switch (policy) {
+	case SCHED_DEADLINE:
+		attr.sched_runtime = (u64)runtime_us * NSEC_PER_USEC;
+		attr.sched_deadline = (u64)deadline_us * NSEC_PER_USEC;
+		attr.sched_period = (u64)period_us * NSEC_PER_USEC;
+		break;
+	case SCHED_FIFO:
+		attr.sched_priority = MAX_RT_PRIO / 2;	/* as sched_set_fifo() does */
+		break;
+	}
+	return sched_setattr_nocheck(current, &attr);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* The (sorted) @v's percentile @pct_x10 / 10, in us */
+static u64 pctile(const u64 *v, uint n, uint pct_x10)
+{
+	uint idx = div_u64((u64)n * pct_x10, 1000);
+
+	if (idx >= n)
+		idx = n - 1;
+	return div_u64(v[idx], NSEC_PER_USEC);
+}
+
+/* Run the periodic task under @policy, then log the results */
+static void run_policy(const char *name, int policy)
+{
+	u64 period = (u64)period_us * NSEC_PER_USEC;
+	u64 deadline = (u64)deadline_us * NSEC_PER_USEC;
+	u64 start, release, finish;
+	uint k, misses = 0, overruns = 0;
+	ktime_t t;
+	int ret;
+
+	ret = set_policy(policy);
+	if (ret) {
+		pr_warn("%s: sched_setattr_nocheck() failed (%d)%s\n", name, ret,
+			ret == -EBUSY ? " - admission control: runtime/period too high?" : "");
+		return;
+	}
+
+	start = ktime_get_ns() + 10 * NSEC_PER_MSEC;	/* begin in 10 ms */
+	for (k = 0; k < njobs && !kthread_should_stop(); k++) {
+		release = start + k * period;
+		if (ktime_get_ns() < release) {
+			t = ns_to_ktime(release);
+			set_current_state(TASK_UNINTERRUPTIBLE);
+			schedule_hrtimeout_range(&t, 0, HRTIMER_MODE_ABS);
+		}
+		lkp_burn_us(work_us);	/* the job */
+		finish = ktime_get_ns();
+
+		resp[k] = finish - release;
+		if (finish > release + deadline)
+			misses++;
+		if (finish > release + period)
+			overruns++;
+	}
+	if (!k)			/* (if stopped early, we report what we have) */
+		return;
+
+	sort(resp, k, sizeof(u64), cmp_u64, NULL);
+	pr_info("%-14s: response (us) min %llu p50 %llu p99 %llu p99.9 %llu max %llu; %u deadline misses, %u overruns in %u jobs\n",
+		name, div_u64(resp[0], NSEC_PER_USEC), pctile(resp, k, 500), pctile(resp, k, 990),
+		pctile(resp, k, 999), div_u64(resp[k - 1], NSEC_PER_USEC), misses, overruns, k);
+}
+
+static int periodic_thread(void *arg)
+{
+	char *list, *p, *tok;
+
+	lkp_burn_calibrate();
+	pr_info("period %u us, deadline %u us, work %u us (DL runtime %u us), %u jobs; %llu loops/ms\n",
+		period_us, deadline_us, work_us, runtime_us, njobs, lkp_loops_per_ms);
+
+	list = kstrdup(policies, GFP_KERNEL);
+	p = list;
+	while (list && (tok = strsep(&p, ",")) && !kthread_should_stop()) {
+		if (!strcasecmp(tok, "deadline") || !strcasecmp(tok, "dl"))
+			run_policy("SCHED_DEADLINE", SCHED_DEADLINE);
+		else if (!strcasecmp(tok, "fifo"))
+			run_policy("SCHED_FIFO", SCHED_FIFO);
+		else if (!strcasecmp(tok, "other") || !strcasecmp(tok, "normal"))
+			run_policy("SCHED_OTHER", SCHED_NORMAL);
+		else if (*tok)
+			pr_warn("unknown policy '%s', skipped\n", tok);
+	}
+	kfree(list);
+	set_policy(SCHED_NORMAL);
+	pr_info("done\n");
+	complete(&done);
+
+	/* wait to be stopped */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static int __init sched_periodic_init(void)
+{
+	if (!deadline_us)
+		deadline_us = period_us;
+	if (!runtime_us)
+		runtime_us = work_us + work_us / 10;
+	if (!period_us || !njobs || deadline_us > period_us || runtime_us > deadline_us) {
+		pr_warn("invalid parameters: need runtime <= deadline <= period, njobs > 0\n");
+		return -EINVAL;
+	}
+
+	resp = kvmalloc_array(njobs, sizeof(u64), GFP_KERNEL);
+	if (!resp)
+		return -ENOMEM;
+
+	tsk = kthread_run(periodic_thread, NULL, OURMODNAME);
+	if (IS_ERR(tsk)) {
+		kvfree(resp);
+		return PTR_ERR(tsk);
+	}
+	get_task_struct(tsk);	/* so that kthread_stop() is safe even if it's exited */
+	pr_info("kthread PID %d running; results in the kernel log\n", task_pid_nr(tsk));
+	return 0;		/* success */
+}
+
+static void __exit sched_periodic_exit(void)
+{
+	kthread_stop(tsk);
+	put_task_struct(tsk);
+	if (!completion_done(&done))
+		pr_info("stopped before completing all runs\n");
+	kvfree(resp);
+	pr_info("removed\n");
+}
+
+module_init(sched_periodic_init);
+module_exit(sched_periodic_exit);
@@ -18,6 +18,12 @@
  * code where we access global / shared writeable data.
  * The functionality (the get and set of the 'secret') remains identical to the
  * original implementation.
+ * The write method's staging buffer now comes from a mempool of 'stg_reserve'
+ * pre-allocated objects from a dedicated slab cache (rather than a kvmalloc()
+ * per write), so that writes make guaranteed forward progress, with bounded
+ * latency, even when the page allocator is struggling: mempool_alloc() falls
+ * back on the reserve (and, with GFP_KERNEL, waits for an element to be freed
+ * rather than fail). See the test_mempool_pressure.sh script.
  *
  * For details, please refer the book, Ch 12.
  */
@@ -39,6 +45,7 @@
 #endif
 
 #include <linux/mutex.h>	// mutex lock, unlock, etc
+#include <linux/mempool.h>
 #include "../../convenient.h"
 
 #define OURMODNAME   "miscdrv_rdwr_mutexlock"
@@ -49,6 +56,16 @@ MODULE_DESCRIPTION
 MODULE_LICENSE("Dual MIT/GPL");
 MODULE_VERSION("0.1");
 
+static int stg_reserve = 16;
+module_param(stg_reserve, int, 0444);
+MODULE_PARM_DESC(stg_reserve, "# of pre-allocated write staging buffers held in reserve (default 16)");
+
+/* Size of a write staging buffer; only the first MAXBYTES of it are used */
+#define STG_BUFSZ   PAGE_SIZE
+
+static struct kmem_cache *stg_cachep;
+static mempool_t *stg_pool;
+
 static int ga, gb = 1;
 DEFINE_MUTEX(lock1);		// this mutex lock is meant to protect the integers ga and gb
 
@@ -170,18 +187,24 @@ static ssize_t write_miscdrv_rdwr(struct file *filp, const char __user *ubuf,
 {
 	int ret;
 	void *kbuf = NULL;
+	size_t stg_count = min_t(size_t, count, STG_BUFSZ);
 	struct device *dev = ctx->dev;
 
 	PRINT_CTX();
 	dev_info(dev, "%s wants to write %zu bytes\n", current->comm, count);
 
+	/* With GFP_KERNEL (can sleep), mempool_alloc() never fails: if the slab
+	 * cache can't deliver, it hands out a reserved element, or waits for one
+	 * to be returned. We only ever use the first MAXBYTES of what's written,
+	 * so one (page-sized) staging buffer suffices for any write.
+	 */
 	ret = -ENOMEM;
-	kbuf = kvmalloc(count, GFP_KERNEL);
+	kbuf = mempool_alloc(stg_pool, GFP_KERNEL);
 	if (unlikely(!kbuf)) {
-		dev_warn(dev, "kvmalloc() failed!\n");
+		dev_warn(dev, "mempool_alloc() failed!\n");
 		goto out_nomem;
 	}
-	memset(kbuf, 0, count);
+	memset(kbuf, 0, STG_BUFSZ);
 
 	/* Copy in the user supplied buffer 'ubuf' - the data content to write -
 	 * via the copy_from_user() macro.
@@ -191,7 +214,7 @@ static ssize_t write_miscdrv_rdwr(struct file *filp, const char __user *ubuf,
 	 *  Returns 0 on success, i.e., non-zero return implies an I/O fault).
 	 */
 	ret = -EFAULT;
-	if (copy_from_user(kbuf, ubuf, count)) {
+	if (copy_from_user(kbuf, ubuf, stg_count)) {
 		dev_warn(dev, "copy_from_user() failed\n");
 		goto out_cfu;
 	}
@@ -203,7 +226,7 @@ static ssize_t write_miscdrv_rdwr(struct file *filp, const char __user *ubuf,
 	 * new 'secret' into our driver 'context' structure, and unlock.
 	 */
 	mutex_lock(&ctx->lock);
-	strscpy(ctx->oursecret, kbuf, (count > MAXBYTES ? MAXBYTES : count));
+	strscpy(ctx->oursecret, kbuf, (stg_count > MAXBYTES ? MAXBYTES : stg_count));
 #if 0
 	print_hex_dump_bytes("ctx ", DUMP_PREFIX_OFFSET, ctx, sizeof(struct drv_ctx));
 #endif
@@ -216,7 +239,7 @@ static ssize_t write_miscdrv_rdwr(struct file *filp, const char __user *ubuf,
 	mutex_unlock(&ctx->lock);
 
  out_cfu:
-	kvfree(kbuf);
+	mempool_free(kbuf, stg_pool);
  out_nomem:
 	return ret;
 }
@@ -272,10 +295,22 @@ static int __init miscdrv_init_mutexlock(void)
 {
 	int ret;
 
+	/* The write path's emergency reserve: a mempool over a dedicated cache */
+	if (stg_reserve <= 0)
+		return -EINVAL;
+	stg_cachep = kmem_cache_create("llkd_miscdrv_stg", STG_BUFSZ, 0, 0, NULL);
+	if (!stg_cachep)
+		return -ENOMEM;
+	stg_pool = mempool_create_slab_pool(stg_reserve, stg_cachep);
+	if (!stg_pool) {
+		kmem_cache_destroy(stg_cachep);
+		return -ENOMEM;
+	}
+
 	ret = misc_register(&llkd_miscdev);
 	if (ret < 0) {
 		pr_notice("misc device registration failed, aborting\n");
-		return ret;
+		goto out_pool;
 	}
 	pr_info("LLKD misc driver (major # 10) registered, minor# = %d,"
 		" dev node is /dev/llkd_miscdrv_rdwr\n", llkd_miscdev.minor);
@@ -286,9 +321,10 @@ static int __init miscdrv_init_mutexlock(void)
 	 * freeing the memory automatically upon driver 'detach' or when the driver
 	 * is unloaded from memory
 	 */
+	ret = -ENOMEM;
 	ctx = kzalloc(sizeof(struct drv_ctx), GFP_KERNEL);
 	if (unlikely(!ctx))
-		return -ENOMEM;
+		goto out_misc;
 
 	mutex_init(&ctx->lock);
 
@@ -306,7 +342,16 @@ static int __init miscdrv_init_mutexlock(void)
 	 */
 
 	dev_dbg(ctx->dev, "A sample print via the dev_dbg(): driver initialized\n");
+	pr_info("write staging: %d x %lu byte buffers held in reserve\n",
+		stg_reserve, STG_BUFSZ);
 	return 0;		/* success */
+
+ out_misc:
+	misc_deregister(&llkd_miscdev);
+ out_pool:
+	mempool_destroy(stg_pool);
+	kmem_cache_destroy(stg_cachep);
+	return ret;
 }
 
 static void __exit miscdrv_exit_mutexlock(void)
@@ -314,6 +359,8 @@ static void __exit miscdrv_exit_mutexlock(void)
 	mutex_destroy(&lock1);
 	mutex_destroy(&ctx->lock);
 	misc_deregister(&llkd_miscdev);
+	mempool_destroy(stg_pool);
+	kmem_cache_destroy(stg_cachep);
 	pr_info("LLKD misc driver deregistered, bye\n");
 }
 
@@ -0,0 +1,89 @@
+#!/bin/bash
+# ch12/1_miscdrv_rdwr_mutexlock/test_mempool_pressure.sh
+# ***************************************************************
+# This program is part of the source code released for the book
+#  "Linux Kernel Programming"
+#  (c) Author: Kaiwan N Billimoria
+#  Publisher:  Packt
+#  GitHub repository:
+#  https://github.com/PacktPublishing/Linux-Kernel-Programming
+# ****************************************************************
+# Brief Description:
+# Test that the driver's write path makes forward progress under (artificial)
+# memory pressure: using the kernel's failslab fault injection framework, we
+# make *every* slab allocation performed by the writer process fail, and then
+# issue a number of writes to the device. As the staging buffers come from a
+# mempool, each write should still succeed (served from the reserve); we
+# report failures and the min/avg/max per-write latency.
+#
+# Requires a kernel with CONFIG_FAILSLAB=y and CONFIG_FAULT_INJECTION_DEBUG_FS=y,
+# and root. Optionally, run ../../ch9/oom_killer_try (with -D) alongside for
+# genuine page allocator pressure as well.
+#
+# For details, pl refer to the book Ch 12.
+name=$(basename $0)
+KMOD=miscdrv_rdwr_mutexlock
+DEV=/dev/llkd_miscdrv_rdwr_mutexlock
+FAILSLAB=/sys/kernel/debug/failslab
+NWRITES=${1:-1000}
+
+die()
+{
+  echo "${name}: $*" 1>&2
+  exit 1
+}
+
+[ $(id -u) -ne 0 ] && die "need root."
+[ -d ${FAILSLAB} ] || die "${FAILSLAB} not present (need CONFIG_FAILSLAB and debugfs mounted)."
+lsmod |grep -q "^${KMOD} " || {
+  [ -f ./${KMOD}.ko ] || die "build the module first (make)."
+  insmod ./${KMOD}.ko || die "insmod failed."
+}
+[ -c ${DEV} ] || die "device node ${DEV} not present."
+
+# Save the current failslab settings, restore them on exit
+saved_prob=$(cat ${FAILSLAB}/probability)
+saved_times=$(cat ${FAILSLAB}/times)
+saved_tf=$(cat ${FAILSLAB}/task-filter)
+saved_igw=$(cat ${FAILSLAB}/ignore-gfp-wait)
+restore()
+{
+  echo ${saved_prob} > ${FAILSLAB}/probability
+  echo ${saved_times} > ${FAILSLAB}/times
+  echo ${saved_tf} > ${FAILSLAB}/task-filter
+  echo ${saved_igw} > ${FAILSLAB}/ignore-gfp-wait
+}
+trap restore EXIT
+
+# Fail 100% of slab allocations - even ones that may sleep - but only for
+# tasks that have /proc/<pid>/make-it-fail set
+echo 100 > ${FAILSLAB}/probability
+echo -1 > ${FAILSLAB}/times
+echo Y > ${FAILSLAB}/task-filter
+echo N > ${FAILSLAB}/ignore-gfp-wait
+
+echo "[+] ${NWRITES} writes to ${DEV} with all slab allocations of the writer failing ..."
+# The writer: a subshell that opens the device *first* (opening needs slab
+# memory too), then sets make-it-fail on itself and times each write (in us).
+# Everything in the loop is a bash builtin w/o redirections to new files -
+# forking or opening a file would need slab memory!
+# (needs bash 5+ for $EPOCHREALTIME)
+bash -c "
+exec 3>${DEV} || exit 1
+echo 1 > /proc/self/make-it-fail
+fails=0 ; min=0 ; max=0 ; sum=0
+for ((i=1; i<=${NWRITES}; i++)) ; do
+  t1=\${EPOCHREALTIME/./}
+  printf 'secret-%d' \$i >&3 || fails=\$((fails+1))
+  t2=\${EPOCHREALTIME/./}
+  d=\$((t2-t1)) ; sum=\$((sum+d))
+  [ \$min -eq 0 -o \$d -lt \$min ] && min=\$d
+  [ \$d -gt \$max ] && max=\$d
+done
+echo \"writes: ${NWRITES}, failed: \${fails}\"
+echo \"per-write latency: min \${min} us, avg \$((sum/${NWRITES})) us, max \${max} us\"
+[ \${fails} -eq 0 ]
+"
+ret=$?
+[ ${ret} -eq 0 ] && echo "[+] PASS: all writes made progress" || echo "[-] FAIL: some writes failed"
+exit ${ret}
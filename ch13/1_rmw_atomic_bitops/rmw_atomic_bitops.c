@@ -13,6 +13,10 @@
  * Brief Description:
  * A quick demo showing the usage of the RMW (Read Modify Write) atomic bitwise
  * APIs. Here, there's no device, so we simply use these APIs on a RAM variable!
+ * We also time setting the MSB - via set_bit() and via a spinlock-protected
+ * RMW - 'iters' times each, into klib_llkd timing histograms; see the
+ * percentiles in the kernel log or, until rmmod, under
+ * /sys/kernel/debug/2_rmw_atomic_bitops/ .
  *
  * For details, please refer the book, Ch 13.
  */
@@ -23,6 +27,8 @@
 #include <linux/spinlock.h>
 #include <linux/atomic.h>
 #include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include "../../klib_llkd.h"
 #include "../../convenient.h"
 
 #define OURMODNAME   "2_rmw_atomic_bitops"
@@ -33,23 +39,34 @@ MODULE_DESCRIPTION(
 MODULE_LICENSE("Dual MIT/GPL");
 MODULE_VERSION("0.1");
 
+static uint iters = 1000;
+module_param(iters, uint, 0444);
+MODULE_PARM_DESC(iters, "# of times each way of setting the MSB is timed (default=1000)");
+
 #define SHOW(n, p, msg) do {                                   \
 	pr_info("%2d:%27s: mem : %3ld = 0x%02lx\n", n, msg, p, p); \
 } while (0)
 
 static unsigned long mem;
-static u64 t1, t2;
 static int MSB = BITS_PER_BYTE - 1;
 DEFINE_SPINLOCK(slock);
+static struct dentry *gparent;
+static struct llkd_hist *h_optimal, *h_suboptimal;
 
 /* Set the MSB; optimally, with the set_bit() RMW atomic API */
 static inline void setmsb_optimal(int i)
 {
-	t1 = ktime_get_real_ns();
-	set_bit(MSB, &mem);
-	t2 = ktime_get_real_ns();
+	u64 t;
+	uint n;
+
+	for (n = 0; n < iters; n++) {
+		clear_bit(MSB, &mem);
+		LLKD_TIME_START(t);
+		set_bit(MSB, &mem);
+		LLKD_TIME_END(h_optimal, t);
+	}
 	SHOW(i, mem, "set_bit(7,&mem)");
-	SHOW_DELTA(t2, t1);
+	llkd_hist_log(h_optimal);
 }
 /* Set the MSB; the traditional way, using a spinlock to protect the RMW
  * critical section
@@ -57,18 +74,23 @@ static inline void setmsb_optimal(int i)
 static inline void setmsb_suboptimal(int i)
 {
 	u8 tmp;
-
-	t1 = ktime_get_real_ns();
-	spin_lock(&slock);
-	/* critical section: RMW : read, modify, write */
-	tmp = mem;
-	tmp |= 0x80;   // 0x80 = 1000 0000 binary
-	mem = tmp;
-	spin_unlock(&slock);
-	t2 = ktime_get_real_ns();
+	u64 t;
+	uint n;
+
+	for (n = 0; n < iters; n++) {
+		clear_bit(MSB, &mem);
+		LLKD_TIME_START(t);
+		spin_lock(&slock);
+		/* critical section: RMW : read, modify, write */
+		tmp = mem;
+		tmp |= 0x80;   // 0x80 = 1000 0000 binary
+		mem = tmp;
+		spin_unlock(&slock);
+		LLKD_TIME_END(h_suboptimal, t);
+	}
 
 	SHOW(i, mem, "set msb suboptimal: 7,&mem");
-	SHOW_DELTA(t2, t1);
+	llkd_hist_log(h_suboptimal);
 }
 
 static int __init atomic_rmw_bitops_init(void)
@@ -77,6 +99,15 @@ static int __init atomic_rmw_bitops_init(void)
 
 	pr_info("%s: inserted\n", OURMODNAME);
 
+	/* (if any of these fail, the timing's simply not recorded) */
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR(gparent))
+		gparent = NULL;
+	/* without our own dir, prefix the names, else they'd land in the debugfs root as is */
+	h_optimal = llkd_hist_create(gparent ? "set_bit" : OURMODNAME "_set_bit", gparent);
+	h_suboptimal = llkd_hist_create(gparent ? "spinlock_rmw" : OURMODNAME "_spinlock_rmw",
+					gparent);
+
 	SHOW(i++, mem, "at init");
 
 	setmsb_optimal(i++);
@@ -110,6 +141,9 @@ static int __init atomic_rmw_bitops_init(void)
 static void __exit atomic_rmw_bitops_exit(void)
 {
 	mem = 0x0;
+	llkd_hist_destroy(h_optimal);
+	llkd_hist_destroy(h_suboptimal);
+	debugfs_remove_recursive(gparent);
 	pr_info("%s: removed\n", OURMODNAME);
 }
 
@@ -207,6 +207,9 @@ static int __init deadlock_eg_AB_BA_init(void)
 		return -ENOSYS;
 	}
 
+	/* Calibrate DELAY_LOOP's burner now, not while holding our spinlocks */
+	pr_info("%s: CPU burner: %llu loops/ms\n", OURMODNAME, lkp_burn_calibrate());
+
 	/* Spawn two kernel threads */
 	if (run_kthrd("thrd_0", 0) < 0) {
 		pr_info("%s: kthread thrd #0 not created, aborting...\n",
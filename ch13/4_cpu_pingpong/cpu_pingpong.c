@@ -0,0 +1,382 @@
+/*
+ * ch13/4_cpu_pingpong/cpu_pingpong.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 13 : Kernel Synchronization, Part 2
+ ****************************************************************
+ * Brief Description:
+ * Measure the cross-CPU communication latency between every pair of CPUs,
+ * producing two NxN matrices (one-way latency in ns; row = 'from' CPU,
+ * column = 'to' CPU):
+ *  wake : a kthread on CPU 'from' and one on CPU 'to' ping-pong via a pair
+ *         of completions - i.e., the cost of waking up a task on another CPU
+ *         (IPI, scheduling and the wakeup path included)
+ *  spin : the same two kthreads ping-pong by spinning on a shared cacheline -
+ *         i.e., the pure cacheline transfer ('cache to cache') latency
+ * As with ch13/2_percpu, the kthreads are pinned to their CPUs - here via the
+ * (exported) kthread_bind(), so no kallsyms hack is required. Useful to decide
+ * where to place producer/consumer pairs: CPUs sharing a core or an LLC show
+ * up as the low latency 'blocks' of the matrix, other sockets as high ones.
+ * The matrices are printed when done and can be re-read via debugfs:
+ *  /sys/kernel/debug/cpu_pingpong/{wake,spin}
+ * Usage f.e.:
+ *  sudo insmod ./cpu_pingpong.ko [wake_iters=1000] [spin_iters=10000] [maxcpus=N]
+ *
+ * For details, please refer the book, Ch 13.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#define OURMODNAME   "cpu_pingpong"
+#define SPIN_TIMEOUT_NS   (1 * NSEC_PER_SEC)	/* give up spinning after this */
+#define MAX_PRINT_CPUS    32	/* print matrices wider than this only via debugfs */
+
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_DESCRIPTION("LKP book:ch13/4_cpu_pingpong: cross-CPU wakeup and cacheline ping-pong latency matrix");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static uint wake_iters = 1000;
+module_param(wake_iters, uint, 0444);
+MODULE_PARM_DESC(wake_iters, "# of round trips per CPU pair via completions (default=1000; 0 to skip)");
+
+static uint spin_iters = 10000;
+module_param(spin_iters, uint, 0444);
+MODULE_PARM_DESC(spin_iters, "# of round trips per CPU pair via a shared cacheline (default=10000; 0 to skip)");
+
+static uint maxcpus;
+module_param(maxcpus, uint, 0444);
+MODULE_PARM_DESC(maxcpus, "measure only the first maxcpus online CPUs (default=0: all)");
+
+enum pp_mode { PP_WAKE = 0, PP_SPIN, PP_NMODES };
+static const char *pp_mode_name[PP_NMODES] = { "wake", "spin" };
+
+/* The state shared by a ping-pong pair of kthreads */
+struct pingpong {
+	enum pp_mode mode;
+	unsigned int iters;
+	struct completion ping, pong;	/* PP_WAKE */
+	struct completion ready;	/* the responder is up, on it's CPU */
+	struct completion done;		/* the initiator's done measuring */
+	u64 total_ns;
+	bool failed;
+	/* PP_SPIN: the cacheline that bounces between the two CPUs */
+	unsigned int seq ____cacheline_aligned_in_smp;
+};
+
+static unsigned int ncpus, *cpus;	/* the (online) CPUs we measure */
+static u32 *matrix[PP_NMODES];		/* [from * ncpus + to] one-way latency, ns */
+static struct dentry *gparent;
+
+/* Done with our work; hang around until kthread_stop() */
+static void wait_for_stop(void)
+{
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+/* Spin until pp->seq == @val; false on timeout (the peer isn't running?) */
+static bool spin_until(struct pingpong *pp, unsigned int val)
+{
+	u64 start = ktime_get_ns();
+	unsigned int n = 0;
+
+	while (READ_ONCE(pp->seq) != val) {
+		cpu_relax();
+		if (!(++n & 0xfff) && ktime_get_ns() - start > SPIN_TIMEOUT_NS)
+			return false;
+	}
+	return true;
+}
+
+static int responder(void *arg)
+{
+	struct pingpong *pp = arg;
+	unsigned int i;
+
+	complete(&pp->ready);
+	for (i = 0; i < pp->iters; i++) {
+		if (pp->mode == PP_WAKE) {
+			wait_for_completion(&pp->ping);
+			complete(&pp->pong);
+		} else {
+			if (!spin_until(pp, 2 * i + 1))
+				break;
+			WRITE_ONCE(pp->seq, 2 * i + 2);
+		}
+	}
+	wait_for_stop();
+	return 0;
+}
+
+static int initiator(void *arg)
+{
+	struct pingpong *pp = arg;
+	unsigned int i;
+	u64 t1, t2;
+
+	wait_for_completion(&pp->ready);
+	t1 = ktime_get_ns();
+	for (i = 0; i < pp->iters; i++) {
+		if (pp->mode == PP_WAKE) {
+			complete(&pp->ping);
+			wait_for_completion(&pp->pong);
+		} else {
+			WRITE_ONCE(pp->seq, 2 * i + 1);
+			if (!spin_until(pp, 2 * i + 2)) {
+				pp->failed = true;
+				break;
+			}
+		}
+	}
+	t2 = ktime_get_ns();
+	pp->total_ns = t2 - t1;
+	complete(&pp->done);
+	wait_for_stop();
+	return 0;
+}
+
+static struct task_struct *start_on(int (*fn)(void *), struct pingpong *pp,
+				    unsigned int cpu, const char *role)
+{
+	struct task_struct *t;
+
+	t = kthread_create_on_node(fn, pp, cpu_to_node(cpu), "%s/%s/%u", OURMODNAME, role, cpu);
+	if (IS_ERR(t))
+		return t;
+	kthread_bind(t, cpu);
+	get_task_struct(t);
+	wake_up_process(t);
+	return t;
+}
+
+/*
+ * measure_pair - ping-pong @iters round trips between CPUs @from and @to;
+ * returns the average one-way latency in ns, 0 on failure.
+ */
+static u32 measure_pair(enum pp_mode mode, unsigned int iters, unsigned int from, unsigned int to)
+{
+	struct task_struct *ti, *tr;
+	struct pingpong *pp;
+	u32 ret = 0;
+
+	pp = kzalloc(sizeof(struct pingpong), GFP_KERNEL);
+	if (!pp)
+		return 0;
+	pp->mode = mode;
+	pp->iters = iters;
+	init_completion(&pp->ping);
+	init_completion(&pp->pong);
+	init_completion(&pp->ready);
+	init_completion(&pp->done);
+
+	tr = start_on(responder, pp, to, "resp");
+	if (IS_ERR(tr))
+		goto out;
+	ti = start_on(initiator, pp, from, "init");
+	if (IS_ERR(ti)) {
+		/*
+		 * unblock the responder: it's waiting on the first ping - the
+		 * completion, or (spin mode) seq == 1; it then sees iters == 0
+		 */
+		pp->iters = 0;
+		complete_all(&pp->ping);
+		WRITE_ONCE(pp->seq, 1);
+		kthread_stop(tr);
+		put_task_struct(tr);
+		goto out;
+	}
+	/*
+	 * Wait for the initiator to be done; only then stop the threads (a
+	 * kthread stopped before it gets to run never runs it's function at all).
+	 * The responder's done too by now, or soon will be (on a spin timeout,
+	 * it bails out as well).
+	 */
+	wait_for_completion(&pp->done);
+	kthread_stop(ti);
+	put_task_struct(ti);
+	kthread_stop(tr);
+	put_task_struct(tr);
+
+	if (!pp->failed)
+		ret = (u32)div64_u64(pp->total_ns, 2ULL * iters);
+out:
+	kfree(pp);
+	return ret;
+}
+
+static void run_matrix(enum pp_mode mode, unsigned int iters)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < ncpus; i++) {
+		for (j = 0; j < ncpus; j++) {
+			if (i == j)
+				continue;
+			matrix[mode][i * ncpus + j] = measure_pair(mode, iters, cpus[i], cpus[j]);
+			cond_resched();
+		}
+	}
+}
+
+static void show_matrix(struct seq_file *m, enum pp_mode mode)
+{
+	unsigned int i, j;
+	u32 v;
+
+	seq_printf(m, "%s: one-way latency (ns), from (row) -> to (column)\n",
+		   pp_mode_name[mode]);
+	seq_printf(m, "%6s", "");
+	for (j = 0; j < ncpus; j++)
+		seq_printf(m, " %6u", cpus[j]);
+	seq_puts(m, "\n");
+	for (i = 0; i < ncpus; i++) {
+		seq_printf(m, "%6u", cpus[i]);
+		for (j = 0; j < ncpus; j++) {
+			v = matrix[mode][i * ncpus + j];
+			if (i == j)
+				seq_printf(m, " %6s", "-");
+			else if (!v)
+				seq_printf(m, " %6s", "fail");
+			else
+				seq_printf(m, " %6u", v);
+		}
+		seq_puts(m, "\n");
+	}
+}
+
+static int wake_show(struct seq_file *m, void *v)
+{
+	show_matrix(m, PP_WAKE);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(wake);
+
+static int spin_show(struct seq_file *m, void *v)
+{
+	show_matrix(m, PP_SPIN);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(spin);
+
+/* Print the matrix to the kernel log, a row per printk */
+static void print_matrix(enum pp_mode mode)
+{
+	unsigned int i, j;
+	char *buf;
+	u32 v;
+	int n;
+
+	buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!buf)
+		return;
+	pr_info("%s: one-way latency (ns), from (row) -> to (column)\n", pp_mode_name[mode]);
+	n = scnprintf(buf, PAGE_SIZE, "%6s", "");
+	for (j = 0; j < ncpus; j++)
+		n += scnprintf(buf + n, PAGE_SIZE - n, " %6u", cpus[j]);
+	pr_info("%s\n", buf);
+	for (i = 0; i < ncpus; i++) {
+		n = scnprintf(buf, PAGE_SIZE, "%6u", cpus[i]);
+		for (j = 0; j < ncpus; j++) {
+			v = matrix[mode][i * ncpus + j];
+			if (i == j)
+				n += scnprintf(buf + n, PAGE_SIZE - n, " %6s", "-");
+			else if (!v)
+				n += scnprintf(buf + n, PAGE_SIZE - n, " %6s", "fail");
+			else
+				n += scnprintf(buf + n, PAGE_SIZE - n, " %6u", v);
+		}
+		pr_info("%s\n", buf);
+	}
+	kfree(buf);
+}
+
+static int __init cpu_pingpong_init(void)
+{
+	unsigned int cpu, n, iters[PP_NMODES] = { wake_iters, spin_iters };
+	int mode, ret = -ENOMEM;
+
+	n = num_online_cpus();
+	if (maxcpus && maxcpus < n)
+		n = maxcpus;
+	if (n < 2) {
+		pr_info("need at least 2 CPUs, nothing to do\n");
+		return -EINVAL;
+	}
+	cpus = kcalloc(n, sizeof(unsigned int), GFP_KERNEL);
+	if (!cpus)
+		return -ENOMEM;
+	for (mode = 0; mode < PP_NMODES; mode++) {
+		matrix[mode] = kcalloc(n * n, sizeof(u32), GFP_KERNEL);
+		if (!matrix[mode])
+			goto out_free;
+	}
+	/* (CPU hotplug while we run isn't handled: the kthread_bind()'s would fail) */
+	ncpus = 0;
+	for_each_online_cpu(cpu) {
+		cpus[ncpus++] = cpu;
+		if (ncpus == n)
+			break;
+	}
+	pr_info("measuring %u x %u CPU pairs (%u wake, %u spin round trips each)...\n",
+		ncpus, ncpus - 1, wake_iters, spin_iters);
+
+	for (mode = 0; mode < PP_NMODES; mode++) {
+		if (!iters[mode])
+			continue;
+		run_matrix(mode, iters[mode]);
+		if (ncpus <= MAX_PRINT_CPUS)
+			print_matrix(mode);
+	}
+
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent)) {
+		pr_warn("debugfs_create_dir() failed\n");
+	} else {
+		debugfs_create_file("wake", 0444, gparent, NULL, &wake_fops);
+		debugfs_create_file("spin", 0444, gparent, NULL, &spin_fops);
+	}
+	pr_info("done; see /sys/kernel/debug/%s/{wake,spin}\n", OURMODNAME);
+	return 0;		/* success */
+
+out_free:
+	for (mode = 0; mode < PP_NMODES; mode++)
+		kfree(matrix[mode]);
+	kfree(cpus);
+	return ret;
+}
+
+static void __exit cpu_pingpong_exit(void)
+{
+	int mode;
+
+	debugfs_remove_recursive(gparent);
+	for (mode = 0; mode < PP_NMODES; mode++)
+		kfree(matrix[mode]);
+	kfree(cpus);
+	pr_info("removed\n");
+}
+
+module_init(cpu_pingpong_init);
+module_exit(cpu_pingpong_exit);
@@ -0,0 +1,227 @@
+/*
+ * ch4/printk_loglvl/printk_bench.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 4: Writing your First Kernel Module - LKMs Part 1
+ ****************************************************************
+ * Brief Description:
+ * printk_loglvl shows *where* printk's go; this one shows what they cost. We
+ * time 'iters' calls - on 'nthreads' CPUs concurrently, to show contention -
+ * of each of these ways to log a (three argument) message:
+ *  printk      : printk(KERN_DEBUG ...); it goes into the kernel log buffer
+ *                (though, below the console log level, not to the console)
+ *  ratelimited : pr_info_ratelimited() - what our DBGPRINT() does by default;
+ *                cheap, as most messages are simply dropped!
+ *  trace_printk: into the (per-CPU) ftrace ring buffer; args packed, not
+ *                formatted
+ *  blog        : klib_llkd's per-CPU lockless binary log (llkd_blog_printf());
+ *                ditto - formatted only when read
+ *  dbg-off     : a DBGPRINT() whose (dynamic debug) call site is disabled -
+ *                the cost of logging that's compiled in but off. (Load us
+ *                with dyndbg=+p dbg_backend=<ratelimit|printk|trace|blog> to
+ *                time an enabled DBGPRINT() via each backend instead)
+ * and report the average and worst per-thread cost per call, in ns.
+ * The records logged can be seen via dmesg, /sys/kernel/debug/tracing/trace
+ * and /sys/kernel/debug/printk_bench/log respectively.
+ * Note: this module uses trace_printk(), so the kernel logs it's (scary
+ * looking but harmless) 'trace_printk() being used' notice on load.
+ *
+ * For details, please refer the book, Ch 4.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include "../../klib_llkd.h"
+#include "../../convenient.h"
+
+#define OURMODNAME   "printk_bench"
+
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_DESCRIPTION("LKP book:ch4/printk_loglvl: printk vs trace_printk vs per-CPU binary log cost");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+LKP_DBG_DEFINE_PARAM();		/* our DBGPRINT()'s dbg_backend= parameter */
+
+static uint iters = 10000;
+module_param(iters, uint, 0444);
+MODULE_PARM_DESC(iters, "# of messages each thread logs, per method (default=10000)");
+
+static uint nthreads = 1;
+module_param(nthreads, uint, 0444);
+MODULE_PARM_DESC(nthreads, "# of CPUs logging concurrently (default=1; 0 = all online CPUs)");
+
+enum bench_method {
+	BENCH_PRINTK = 0,
+	BENCH_RATELIMITED,
+	BENCH_TRACE,
+	BENCH_BLOG,
+	BENCH_DBG_OFF,
+	BENCH_NUM
+};
+static const char * const method_names[BENCH_NUM] = {
+	"printk", "ratelimited", "trace_printk", "blog", "dbg-off"
+};
+
+struct bench_thread {
+	struct task_struct *tsk;
+	enum bench_method method;
+	u64 ns;			/* time taken for all 'iters' calls */
+	struct completion done;
+};
+
+static struct llkd_blog *blog;
+static DECLARE_COMPLETION(go);
+
+/* Done with our work; hang around until kthread_stop() */
+static void wait_for_stop(void)
+{
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+static int bench_thread(void *arg)
+{
+	struct bench_thread *bt = arg;
+	int cpu = raw_smp_processor_id();	/* we're bound to it */
+	u64 t1, t2;
+	uint i;
+
+	wait_for_completion(&go);
+	t1 = ktime_get_ns();
+	switch (bt->method) {
+	case BENCH_PRINTK:
+		for (i = 0; i < iters; i++)
+			printk(KERN_DEBUG "bench: cpu %d iter %u of %u\n", cpu, i, iters);
+		break;
+	case BENCH_RATELIMITED:
+		for (i = 0; i < iters; i++)
+			pr_info_ratelimited("bench: cpu %d iter %u of %u\n", cpu, i, iters);
+		break;
+	case BENCH_TRACE:
+		for (i = 0; i < iters; i++)
+			trace_printk("bench: cpu %d iter %u of %u\n", cpu, i, iters);
+		break;
+	case BENCH_BLOG:
+		for (i = 0; i < iters; i++)
+			llkd_blog_printf(blog, "bench: cpu %d iter %u of %u\n", cpu, i, iters);
+		break;
+	case BENCH_DBG_OFF:
+		for (i = 0; i < iters; i++)
+			DBGPRINT("bench: cpu %d iter %u of %u\n", cpu, i, iters);
+		break;
+	default:
+		break;
+	}
+	t2 = ktime_get_ns();
+	bt->ns = t2 - t1;
+
+	complete(&bt->done);
+	wait_for_stop();
+	return 0;
+}
+
+/* Run one method on @n CPUs at once; log the mean and worst ns per call */
+static int run_method(struct bench_thread *bts, unsigned int n, enum bench_method method)
+{
+	u64 sum = 0, worst = 0;
+	unsigned int i = 0, j;
+	int cpu, ret = 0;
+
+	reinit_completion(&go);
+	for_each_online_cpu(cpu) {
+		struct bench_thread *bt = &bts[i];
+		struct task_struct *t;
+
+		if (i == n)
+			break;
+		bt->method = method;
+		bt->ns = 0;
+		init_completion(&bt->done);
+		t = kthread_create_on_node(bench_thread, bt, cpu_to_node(cpu), "%s/%d",
+					   OURMODNAME, cpu);
+		if (IS_ERR(t)) {
+			ret = PTR_ERR(t);
+			break;
+		}
+		kthread_bind(t, cpu);
+		get_task_struct(t);
+		bt->tsk = t;
+		wake_up_process(t);
+		i++;
+	}
+
+	complete_all(&go);		/* ... and they're off */
+	for (j = 0; j < i; j++) {
+		wait_for_completion(&bts[j].done);
+		kthread_stop(bts[j].tsk);
+		put_task_struct(bts[j].tsk);
+		sum += bts[j].ns;
+		worst = max(worst, bts[j].ns);
+	}
+	if (ret)
+		return ret;
+
+	pr_info("%-12s: %6llu ns/call avg, %6llu worst  (%u CPU(s) x %u calls)\n",
+		method_names[method], div64_u64(sum, (u64)n * iters), div_u64(worst, iters),
+		n, iters);
+	return 0;
+}
+
+static int __init printk_bench_init(void)
+{
+	struct bench_thread *bts;
+	unsigned int n = nthreads ? min(nthreads, num_online_cpus()) : num_online_cpus();
+	int m, ret = 0;
+
+	if (!iters)
+		return -EINVAL;
+	/* (up to) big enough to hold every record of a run */
+	blog = llkd_blog_create(OURMODNAME, min(iters, 16384U) * 64);
+	if (!blog)
+		return -ENOMEM;
+	lkp_dbg_blog = blog;	/* DBGPRINT()'s 'blog' backend logs here too */
+	bts = kcalloc(n, sizeof(struct bench_thread), GFP_KERNEL);
+	if (!bts) {
+		llkd_blog_destroy(blog);
+		return -ENOMEM;
+	}
+
+	pr_info("logging %u messages per thread on %u CPU(s), per method:\n", iters, n);
+	for (m = 0; m < BENCH_NUM; m++) {
+		ret = run_method(bts, n, m);
+		if (ret) {
+			pr_warn("couldn't create our kthreads (%d), aborting\n", ret);
+			break;
+		}
+	}
+	kfree(bts);
+	if (ret)
+		llkd_blog_destroy(blog);
+	return ret;
+}
+
+static void __exit printk_bench_exit(void)
+{
+	llkd_blog_destroy(blog);
+	pr_info("removed\n");
+}
+
+module_init(printk_bench_init);
+module_exit(printk_bench_exit);
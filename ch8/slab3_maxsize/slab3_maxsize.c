@@ -11,25 +11,69 @@
  * From: Ch 8 : Linux Kernel Memory Allocation for Module Authors, Part 1
  ****************************************************************
  * Brief Description:
+ * Find the largest allocation each kernel allocator can serve, and how fast.
+ * By default, for each of
+ *  kmalloc(), kvmalloc(), vmalloc(), alloc_pages_exact() and (if available)
+ *  alloc_contig_pages() (the CMA/contiguous range allocator)
+ * we binary search (to 'granularity' bytes) for the maximum size that can be
+ * allocated right now, printing the latency of every probe, and then time
+ * allocating and freeing a ladder of sizes (powers of 4 pages) up to that
+ * maximum.
+ * Set the module parameter 'linear=1' to instead run the original demo: grow
+ * a kmalloc() by 'stepsz' bytes on each loop iteration until it fails.
  *
  * For details, please refer the book, Ch 8.
  */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
+#if defined(CONFIG_CONTIG_ALLOC) && LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+#include <linux/kprobes.h>
+#include <linux/kallsyms.h>
+#define HAVE_CONTIG_ALLOC	1
+#endif
 
 #define OURMODNAME   "slab3_maxsize"
 
 MODULE_AUTHOR("Kaiwan N Billimoria");
-MODULE_DESCRIPTION("LKP book:ch8/slab3_maxsize: test max alloc limit from k[m|z]alloc()");
+MODULE_DESCRIPTION("LKP book:ch8/slab3_maxsize: test max alloc limit and latency of k[m|v]alloc(), vmalloc(), alloc_pages_exact(), ...");
 MODULE_LICENSE("Dual MIT/GPL");
-MODULE_VERSION("0.1");
+MODULE_VERSION("0.2");
 
 static int stepsz = 200000;
 module_param(stepsz, int, 0644);
 MODULE_PARM_DESC(stepsz,
 "Amount to increase allocation by on each loop iteration (default=200000");
 
+static int linear;
+module_param(linear, int, 0444);
+MODULE_PARM_DESC(linear,
+"if 1, run the original linear kmalloc() sweep (in stepsz increments) instead of the probe (default=0)");
+
+static uint granularity = PAGE_SIZE;
+module_param(granularity, uint, 0444);
+MODULE_PARM_DESC(granularity,
+"resolution (in bytes) to which the maximum size is searched for (default=PAGE_SIZE)");
+
+static uint max_ram_pct = 50;
+module_param(max_ram_pct, uint, 0444);
+MODULE_PARM_DESC(max_ram_pct,
+"never probe beyond this percentage of total RAM (default=50)");
+
+static uint reps = 3;
+module_param(reps, uint, 0444);
+MODULE_PARM_DESC(reps, "number of alloc/free repetitions per size in the latency ladder (default=3)");
+
+/* Don't warn, and fail rather than invoke the OOM killer */
+#define PROBE_GFP   (GFP_KERNEL | __GFP_NOWARN | __GFP_RETRY_MAYFAIL)
+
 static int test_maxallocsz(void)
 {
 	size_t size2alloc = 0;
@@ -48,15 +92,230 @@ static int test_maxallocsz(void)
 	return 0;
 }
 
+/*------------------- the allocators we probe --------------------------*/
+static void *do_kmalloc(size_t sz)
+{
+	return kmalloc(sz, PROBE_GFP);
+}
+static void do_kfree(void *p, size_t sz)
+{
+	kfree(p);
+}
+
+static void *do_kvmalloc(size_t sz)
+{
+	return kvmalloc(sz, PROBE_GFP);
+}
+static void do_kvfree(void *p, size_t sz)
+{
+	kvfree(p);
+}
+
+static void *do_vmalloc(size_t sz)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+	return __vmalloc(sz, PROBE_GFP);
+#else
+	return __vmalloc(sz, PROBE_GFP, PAGE_KERNEL);
+#endif
+}
+static void do_vfree(void *p, size_t sz)
+{
+	vfree(p);
+}
+
+static void *do_alloc_pages_exact(size_t sz)
+{
+	return alloc_pages_exact(sz, PROBE_GFP);
+}
+static void do_free_pages_exact(void *p, size_t sz)
+{
+	free_pages_exact(p, sz);
+}
+
+#ifdef HAVE_CONTIG_ALLOC
+/*
+ * alloc_contig_pages() and free_contig_range() aren't exported to modules.
+ * WARNING! This is considered a hack (as with ch13/2_percpu's use of
+ * sched_setaffinity()): we look up their addresses via kallsyms_lookup_name(),
+ * which - as it too isn't exported on 5.7 and later kernels - we first locate
+ * via a kprobe. Works only when CONFIG_KPROBES and CONFIG_KALLSYMS are on.
+ */
+static struct page *(*ptr_alloc_contig_pages)(unsigned long nr_pages, gfp_t gfp_mask,
+					      int nid, nodemask_t *nodemask);
+static void (*ptr_free_contig_range)(unsigned long pfn, unsigned long nr_pages);
+
+static unsigned long lookup_name(const char *name)
+{
+#ifdef CONFIG_KPROBES
+	struct kprobe kp = { .symbol_name = "kallsyms_lookup_name" };
+	unsigned long (*ptr_kallsyms_lookup_name)(const char *name);
+
+	if (register_kprobe(&kp) < 0)
+		return 0;
+	ptr_kallsyms_lookup_name = (void *)kp.addr;
+	unregister_kprobe(&kp);
+	if (!ptr_kallsyms_lookup_name)
+		return 0;
+	return ptr_kallsyms_lookup_name(name);
+#else
+	return 0;
+#endif
+}
+
+static bool contig_available(void)
+{
+	if (!ptr_alloc_contig_pages || !ptr_free_contig_range) {
+		ptr_alloc_contig_pages = (void *)lookup_name("alloc_contig_pages");
+		ptr_free_contig_range = (void *)lookup_name("free_contig_range");
+	}
+	return ptr_alloc_contig_pages && ptr_free_contig_range;
+}
+
+/* Here, the 'pointer' we hand back is the first struct page of the range */
+static void *do_alloc_contig(size_t sz)
+{
+	return ptr_alloc_contig_pages(DIV_ROUND_UP(sz, PAGE_SIZE), PROBE_GFP,
+				      numa_node_id(), NULL);
+}
+static void do_free_contig(void *p, size_t sz)
+{
+	ptr_free_contig_range(page_to_pfn((struct page *)p), DIV_ROUND_UP(sz, PAGE_SIZE));
+}
+#endif
+
+struct probe_ops {
+	const char *name;
+	void *(*alloc)(size_t sz);
+	void (*free)(void *p, size_t sz);
+};
+
+static const struct probe_ops probes[] = {
+	{ "kmalloc", do_kmalloc, do_kfree },
+	{ "kvmalloc", do_kvmalloc, do_kvfree },
+	{ "vmalloc", do_vmalloc, do_vfree },
+	{ "alloc_pages_exact", do_alloc_pages_exact, do_free_pages_exact },
+#ifdef HAVE_CONTIG_ALLOC
+	{ "alloc_contig_pages", do_alloc_contig, do_free_contig },
+#endif
+};
+
+/*
+ * try_alloc - a single allocate + free of @sz bytes; returns true on success
+ * and the time taken to allocate and to free (in ns) in @alloc_ns, @free_ns.
+ */
+static bool try_alloc(const struct probe_ops *op, size_t sz, u64 *alloc_ns, u64 *free_ns)
+{
+	u64 t1, t2, t3;
+	void *p;
+
+	t1 = ktime_get_ns();
+	p = op->alloc(sz);
+	t2 = ktime_get_ns();
+	if (!p)
+		return false;
+	op->free(p, sz);
+	t3 = ktime_get_ns();
+
+	*alloc_ns = t2 - t1;
+	*free_ns = t3 - t2;
+	return true;
+}
+
+/*
+ * probe_max - binary search, to 'granularity' bytes, for the largest
+ * allocation (<= @limit) that @op can currently serve; returns 0 if even the
+ * smallest one fails.
+ */
+static size_t probe_max(const struct probe_ops *op, size_t limit)
+{
+	size_t lo = 0, hi = limit / granularity, mid;	/* in 'granularity' units */
+	u64 ans, fns;
+	bool ok;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		ok = try_alloc(op, mid * granularity, &ans, &fns);
+		pr_debug("%-18s(%12zu) : %s  alloc %9llu ns  free %9llu ns\n",
+			 op->name, mid * granularity, ok ? " ok " : "FAIL",
+			 ok ? ans : 0, ok ? fns : 0);
+		if (ok)
+			lo = mid;
+		else
+			hi = mid - 1;
+		cond_resched();
+	}
+	return lo * granularity;
+}
+
+/* Time allocating and freeing sizes 1, 4, 16, ... pages up to @max (inclusive) */
+static void latency_ladder(const struct probe_ops *op, size_t max)
+{
+	size_t sz = PAGE_SIZE;
+	u64 ans, fns, asum, fsum;
+	unsigned int r, n;
+
+	while (sz && sz <= max) {
+		asum = fsum = 0;
+		for (r = 0, n = 0; r < reps; r++) {
+			if (!try_alloc(op, sz, &ans, &fns))
+				continue;
+			asum += ans;
+			fsum += fns;
+			n++;
+		}
+		if (n)
+			pr_info(" %-18s %12zu bytes : alloc %10llu ns  free %10llu ns  (avg of %u)\n",
+				op->name, sz, div64_u64(asum, n), div64_u64(fsum, n), n);
+		else
+			pr_info(" %-18s %12zu bytes : failed\n", op->name, sz);
+		if (sz == max)
+			break;
+		sz = (sz << 2 > max) ? max : sz << 2;
+		cond_resched();
+	}
+}
+
+static int test_alloc_limits(void)
+{
+	size_t limit = ((totalram_pages() / 100) * max_ram_pct) << PAGE_SHIFT, max;
+	int i;
+
+	if (!granularity || !reps || !max_ram_pct || max_ram_pct > 100)
+		return -EINVAL;
+	pr_info("probing upto %zu MB (%u%% of RAM) to a granularity of %u bytes\n",
+		limit >> 20, max_ram_pct, granularity);
+
+	for (i = 0; i < ARRAY_SIZE(probes); i++) {
+		const struct probe_ops *op = &probes[i];
+
+#ifdef HAVE_CONTIG_ALLOC
+		if (op->alloc == do_alloc_contig && !contig_available()) {
+			pr_info("%s(): unavailable (couldn't look up the symbols), skipping\n",
+				op->name);
+			continue;
+		}
+#endif
+		max = probe_max(op, limit);
+		pr_info("%s(): max allocation right now = %zu bytes (%zu KB, %zu MB)%s\n",
+			op->name, max, max >> 10, max >> 20,
+			(max + granularity > limit) ? " [hit the probe limit]" : "");
+		latency_ladder(op, max);
+	}
+	return 0;
+}
+
 static int __init slab3_maxsize_init(void)
 {
-	pr_info("%s: inserted\n", OURMODNAME);
-	return test_maxallocsz();
+	pr_info("inserted\n");
+	if (linear)
+		return test_maxallocsz();
+	return test_alloc_limits();
 }
 
 static void __exit slab3_maxsize_exit(void)
 {
-	pr_info("%s: removed\n", OURMODNAME);
+	pr_info("removed\n");
 }
 
 module_init(slab3_maxsize_init);
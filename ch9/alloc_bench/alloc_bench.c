@@ -0,0 +1,467 @@
+/*
+ * ch9/alloc_bench/alloc_bench.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 9 : Kernel Memory Allocation for Module Authors, Part 2
+ ****************************************************************
+ * Brief Description:
+ * The ch8 slab[1-4] and the ch9 slab_custom modules each show one allocator
+ * in isolation. Here, we allocate and free 'nobjs' objects of 'objsz' bytes
+ * (over 'iters' iterations) through each of:
+ *  - kmalloc() / kfree()
+ *  - a dedicated custom slab cache: kmem_cache_alloc() / kmem_cache_free()
+ *  - the page fragment allocator: page_frag_alloc() / page_frag_free()
+ *  - a mempool (backed by our custom cache): mempool_alloc() / mempool_free()
+ *  - the slab bulk API: kmem_cache_alloc_bulk() / kmem_cache_free_bulk()
+ * First single-threaded (in the insmod process context), then concurrently
+ * via one kernel thread bound to each online CPU. For each, we report the
+ * average time per alloc+free pair (in ns) and the memory footprint per
+ * object, so that we can pick the right allocator per object type with data.
+ *
+ * Usage:
+ *  sudo insmod ./alloc_bench.ko [objsz=256] [nobjs=1024] [iters=100] [allcpus=1]
+ *  sudo dmesg ; sudo rmmod alloc_bench
+ *
+ * For details, please refer the book, Ch 8 and 9.
+ */
+#define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/mempool.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include <linux/sort.h>
+#include <linux/version.h>
+
+#define OURMODNAME   "alloc_bench"
+#define OURCACHENAME "alloc_bench_obj"
+
+MODULE_AUTHOR("Kaiwan N Billimoria");
+MODULE_DESCRIPTION("LKP book:ch9/alloc_bench: kmalloc vs kmem_cache vs page_frag vs mempool vs bulk benchmark");
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_VERSION("0.1");
+
+static uint objsz = 256;
+module_param(objsz, uint, 0444);
+MODULE_PARM_DESC(objsz, "size of each object to allocate, in bytes (default=256)");
+
+static uint nobjs = 1024;
+module_param(nobjs, uint, 0444);
+MODULE_PARM_DESC(nobjs, "number of objects allocated (and then freed) per iteration (default=1024)");
+
+static uint iters = 100;
+module_param(iters, uint, 0444);
+MODULE_PARM_DESC(iters, "number of alloc-all/free-all iterations (default=100)");
+
+static int allcpus = 1;
+module_param(allcpus, int, 0444);
+MODULE_PARM_DESC(allcpus, "if 1 (default), also run the benchmark concurrently on all online CPUs");
+
+enum alloc_type {
+	AB_KMALLOC = 0,
+	AB_KMEM_CACHE,
+	AB_PAGE_FRAG,
+	AB_MEMPOOL,
+	AB_CACHE_BULK,
+	AB_MAX
+};
+static const char *alloc_name[AB_MAX] = {
+	"kmalloc", "kmem_cache", "page_frag", "mempool", "cache_bulk"
+};
+
+/* Per-thread benchmark context */
+struct ab_thrd {
+	enum alloc_type type;
+	int cpu;
+	void **ptrs;		/* the nobjs object pointers */
+	u64 ns;			/* total time taken */
+	int err;
+	struct task_struct *tsk;
+};
+
+static struct kmem_cache *ab_cachep;
+static size_t ab_cache_objcost;	/* slab memory per object of our cache */
+static mempool_t *ab_pool;
+static DECLARE_COMPLETION(ab_go);
+static DECLARE_COMPLETION(ab_done);
+static atomic_t ab_nrunning;
+
+/* Free whatever page fragments are still held by our (per-thread) frag cache */
+static void ab_frag_drain(struct page_frag_cache *nc)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+	page_frag_cache_drain(nc);
+#else
+	if (nc->va)
+		__page_frag_cache_drain(virt_to_head_page(nc->va), nc->pagecnt_bias);
+#endif
+}
+
+/*
+ * ab_run_one - allocate and free nobjs objects, iters times, via the given
+ * allocator; returns 0 on success and the total time taken in *ns.
+ */
+static int ab_run_one(enum alloc_type type, void **ptrs, u64 *ns)
+{
+	struct page_frag_cache nc;
+	unsigned int i, n;
+	u64 t1, t2;
+	int ret = 0;
+
+	memset(&nc, 0, sizeof(nc));
+	t1 = ktime_get_ns();
+	for (n = 0; n < iters; n++) {
+		/* Allocate all ... */
+		switch (type) {
+		case AB_KMALLOC:
+			for (i = 0; i < nobjs; i++)
+				if (!(ptrs[i] = kmalloc(objsz, GFP_KERNEL)))
+					goto fail;
+			break;
+		case AB_KMEM_CACHE:
+			for (i = 0; i < nobjs; i++)
+				if (!(ptrs[i] = kmem_cache_alloc(ab_cachep, GFP_KERNEL)))
+					goto fail;
+			break;
+		case AB_PAGE_FRAG:
+			for (i = 0; i < nobjs; i++)
+				if (!(ptrs[i] = page_frag_alloc(&nc, objsz, GFP_KERNEL)))
+					goto fail;
+			break;
+		case AB_MEMPOOL:
+			for (i = 0; i < nobjs; i++)
+				if (!(ptrs[i] = mempool_alloc(ab_pool, GFP_KERNEL)))
+					goto fail;
+			break;
+		case AB_CACHE_BULK:
+			i = 0;
+			if (kmem_cache_alloc_bulk(ab_cachep, GFP_KERNEL, nobjs, ptrs) != nobjs)
+				goto fail;
+			break;
+		default:
+			return -EINVAL;
+		}
+
+		/* ... and then free all */
+		switch (type) {
+		case AB_KMALLOC:
+			for (i = 0; i < nobjs; i++)
+				kfree(ptrs[i]);
+			break;
+		case AB_KMEM_CACHE:
+			for (i = 0; i < nobjs; i++)
+				kmem_cache_free(ab_cachep, ptrs[i]);
+			break;
+		case AB_PAGE_FRAG:
+			for (i = 0; i < nobjs; i++)
+				page_frag_free(ptrs[i]);
+			break;
+		case AB_MEMPOOL:
+			for (i = 0; i < nobjs; i++)
+				mempool_free(ptrs[i], ab_pool);
+			break;
+		case AB_CACHE_BULK:
+			kmem_cache_free_bulk(ab_cachep, nobjs, ptrs);
+			break;
+		default:
+			break;
+		}
+		cond_resched();
+	}
+	t2 = ktime_get_ns();
+	*ns = t2 - t1;
+	goto out;
+
+fail:
+	/* Free the 'i' objects allocated so far in this iteration */
+	pr_warn("%s: allocation %u of %u failed\n", alloc_name[type], i, nobjs);
+	while (i--) {
+		switch (type) {
+		case AB_KMALLOC:
+			kfree(ptrs[i]);
+			break;
+		case AB_KMEM_CACHE:
+			kmem_cache_free(ab_cachep, ptrs[i]);
+			break;
+		case AB_PAGE_FRAG:
+			page_frag_free(ptrs[i]);
+			break;
+		case AB_MEMPOOL:
+			mempool_free(ptrs[i], ab_pool);
+			break;
+		default:	/* the bulk API is all-or-nothing */
+			break;
+		}
+	}
+	ret = -ENOMEM;
+out:
+	ab_frag_drain(&nc);
+	return ret;
+}
+
+static int cmp_ptr(const void *a, const void *b)
+{
+	unsigned long x = (unsigned long)*(void * const *)a;
+	unsigned long y = (unsigned long)*(void * const *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * ab_cache_cost - the slab memory consumed per object of our cache: allocate
+ * nobjs objects, and divide the size of all the distinct slabs (page blocks)
+ * they live in by nobjs (as slab_custom's slab_bytes_used() does). Unlike
+ * kmem_cache_size() - just the object size - this includes the alignment,
+ * any debug metadata and the slab's unused tail.
+ */
+static size_t ab_cache_cost(void)
+{
+	struct page *page, *prev = NULL;
+	size_t bytes = 0, cost = 0;
+	unsigned int i, n;
+	void **objs;
+
+	objs = kvmalloc_array(nobjs, sizeof(void *), GFP_KERNEL);
+	if (!objs)
+		return 0;
+	for (n = 0; n < nobjs; n++) {
+		objs[n] = kmem_cache_alloc(ab_cachep, GFP_KERNEL);
+		if (!objs[n])
+			break;
+	}
+	sort(objs, n, sizeof(void *), cmp_ptr, NULL);
+	for (i = 0; i < n; i++) {
+		page = virt_to_head_page(objs[i]);
+		if (page == prev)
+			continue;
+		bytes += PAGE_SIZE << compound_order(page);
+		prev = page;
+	}
+	if (n)
+		cost = bytes / n;
+	for (i = 0; i < n; i++)
+		kmem_cache_free(ab_cachep, objs[i]);
+	kvfree(objs);
+	return cost;
+}
+
+/*
+ * ab_footprint - the memory actually consumed per object by the given
+ * allocator (as opposed to the objsz bytes we asked for).
+ */
+static size_t ab_footprint(enum alloc_type type)
+{
+	size_t sz = objsz;
+	void *p;
+
+	switch (type) {
+	case AB_KMALLOC:
+		p = kmalloc(objsz, GFP_KERNEL);
+		if (p) {
+			sz = ksize(p);
+			kfree(p);
+		}
+		break;
+	case AB_KMEM_CACHE:
+	case AB_MEMPOOL:
+	case AB_CACHE_BULK:
+		if (ab_cache_objcost)
+			sz = ab_cache_objcost;
+		break;
+	case AB_PAGE_FRAG:
+		/* fragments are carved out back-to-back from a (compound) page */
+		sz = objsz;
+		break;
+	default:
+		break;
+	}
+	return sz;
+}
+
+/* Our per-CPU kernel thread worker routine */
+static int ab_thrd_work(void *arg)
+{
+	struct ab_thrd *t = arg;
+
+	wait_for_completion(&ab_go);
+	t->err = ab_run_one(t->type, t->ptrs, &t->ns);
+	if (atomic_dec_and_test(&ab_nrunning))
+		complete(&ab_done);
+
+	/* Hang around until kthread_stop() is invoked on us */
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			break;
+		}
+		schedule();
+	}
+	return 0;
+}
+
+static inline u64 ab_ns_per_op(u64 ns)
+{
+	/* one 'op' = one alloc + one free */
+	return div64_u64(ns, (u64)iters * nobjs);
+}
+
+static int ab_run_allcpus(enum alloc_type type)
+{
+	struct ab_thrd *thrds;
+	unsigned int nthrds = num_online_cpus(), i = 0, n;
+	u64 sum = 0, max = 0;
+	int cpu, ret = 0;
+
+	thrds = kcalloc(nthrds, sizeof(struct ab_thrd), GFP_KERNEL);
+	if (!thrds)
+		return -ENOMEM;
+
+	reinit_completion(&ab_go);
+	reinit_completion(&ab_done);
+	atomic_set(&ab_nrunning, 0);
+
+	for_each_online_cpu(cpu) {
+		struct ab_thrd *t;
+
+		if (i >= nthrds)
+			break;
+		t = &thrds[i];
+		t->type = type;
+		t->cpu = cpu;
+		t->ptrs = kvmalloc_array(nobjs, sizeof(void *), GFP_KERNEL);
+		if (!t->ptrs) {
+			ret = -ENOMEM;
+			break;
+		}
+		t->tsk = kthread_create_on_node(ab_thrd_work, t, cpu_to_node(cpu),
+						"%s/%d", OURMODNAME, cpu);
+		if (IS_ERR(t->tsk)) {
+			ret = PTR_ERR(t->tsk);
+			t->tsk = NULL;
+			kvfree(t->ptrs);
+			break;
+		}
+		kthread_bind(t->tsk, cpu);
+		atomic_inc(&ab_nrunning);
+		wake_up_process(t->tsk);
+		i++;
+	}
+	n = i;
+
+	/* Release them all at (more or less) the same time */
+	complete_all(&ab_go);
+	if (n)
+		wait_for_completion(&ab_done);
+
+	for (i = 0; i < n; i++) {
+		kthread_stop(thrds[i].tsk);
+		kvfree(thrds[i].ptrs);
+		if (thrds[i].err) {
+			ret = thrds[i].err;
+			continue;
+		}
+		sum += thrds[i].ns;
+		if (thrds[i].ns > max)
+			max = thrds[i].ns;
+	}
+
+	if (!ret && n) {
+		/* aggregate throughput: total ops done / wall time (~ the slowest thread) */
+		pr_info("%-10s  %3u cpus : avg %6llu ns/op  (slowest cpu %6llu ns/op)  ~%llu Kops/s total\n",
+			alloc_name[type], n, ab_ns_per_op(div64_u64(sum, n)), ab_ns_per_op(max),
+			max ? div64_u64((u64)n * iters * nobjs * NSEC_PER_MSEC, max) : 0);
+	}
+	kfree(thrds);
+	return ret;
+}
+
+static int ab_run_single(enum alloc_type type)
+{
+	void **ptrs;
+	u64 ns = 0;
+	int ret;
+
+	ptrs = kvmalloc_array(nobjs, sizeof(void *), GFP_KERNEL);
+	if (!ptrs)
+		return -ENOMEM;
+	ret = ab_run_one(type, ptrs, &ns);
+	if (!ret)
+		pr_info("%-10s    1 cpu  : avg %6llu ns/op  footprint %5zu bytes/obj (asked for %u)\n",
+			alloc_name[type], ab_ns_per_op(ns), ab_footprint(type), objsz);
+	kvfree(ptrs);
+	return ret;
+}
+
+static int __init alloc_bench_init(void)
+{
+	enum alloc_type type;
+	int ret = -ENOMEM;
+
+	if (!objsz || objsz > PAGE_SIZE || !nobjs || !iters) {
+		pr_warn("invalid parameter(s): objsz must be in [1..%lu], nobjs and iters > 0\n",
+			PAGE_SIZE);
+		return -EINVAL;
+	}
+	pr_info("inserted; objsz=%u nobjs=%u iters=%u allcpus=%d (1 op = 1 alloc + 1 free)\n",
+		objsz, nobjs, iters, allcpus);
+
+	ab_cachep = kmem_cache_create(OURCACHENAME, objsz, sizeof(long), 0, NULL);
+	if (!ab_cachep) {
+		pr_warn("kmem_cache_create() failed\n");
+		return -ENOMEM;
+	}
+	ab_cache_objcost = ab_cache_cost();
+
+	/* The mempool pre-allocates (reserves) nobjs objects from our cache */
+	ab_pool = mempool_create_slab_pool(nobjs, ab_cachep);
+	if (!ab_pool) {
+		pr_warn("mempool_create_slab_pool() failed\n");
+		goto out_cache;
+	}
+	pr_info("mempool: %u objects (%zu KB) held in reserve\n",
+		nobjs, (nobjs * (ab_cache_objcost ? : (size_t)objsz)) >> 10);
+
+	for (type = 0; type < AB_MAX; type++) {
+		ret = ab_run_single(type);
+		if (ret < 0)
+			goto out_pool;
+	}
+	if (allcpus) {
+		for (type = 0; type < AB_MAX; type++) {
+			ret = ab_run_allcpus(type);
+			if (ret < 0)
+				goto out_pool;
+		}
+	}
+	return 0;		/* success */
+
+out_pool:
+	mempool_destroy(ab_pool);
+out_cache:
+	kmem_cache_destroy(ab_cachep);
+	return ret;
+}
+
+static void __exit alloc_bench_exit(void)
+{
+	mempool_destroy(ab_pool);
+	kmem_cache_destroy(ab_cachep);
+	pr_info("removed\n");
+}
+
+module_init(alloc_bench_init);
+module_exit(alloc_bench_exit);
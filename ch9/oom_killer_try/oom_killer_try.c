@@ -17,6 +17,16 @@
  * freeing back memory to the system. Ultimately, the kernel will kill it via
  * OOM. For a more "sure" kill, set the "force-page-fault" flag.
  *
+ * It's also a configurable memory-pressure and page-fault latency generator:
+ * memory can come from malloc(), anonymous mmap() or a file-backed (shared)
+ * mmap(), optionally with MAP_POPULATE and madvise(MADV_HUGEPAGE), and each
+ * block can be dropped (munmap()) after being touched to generate a sustained
+ * fault load rather than an OOM. Every page of every block is
+ * touched - from one or more threads - and the latency of each first touch
+ * (i.e., each page fault) is recorded into a log2 histogram; we report it,
+ * along with the fault throughput, at the end (or on ^C).
+ * Run it with -h for the details.
+ *
  ** WARNING **
  * Be warned that running this intensively can/will cause heavy swapping on
  * your system and might even necessitate a reboot; to be safe, only run this
@@ -24,73 +34,417 @@
  *
  * For details, please refer the book, Ch 9.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 #define BLK	(getpagesize()*2)
+#define NBUCKETS	40	/* log2(ns) buckets: [2^i, 2^(i+1)) ns */
+
+enum mem_mode { MODE_MALLOC = 0, MODE_ANON, MODE_FILE };
+
+/* The configuration; set via the command line */
+static struct {
+	long count;		/* # of blocks to allocate per thread; 0 = until failure */
+	size_t blksz;
+	enum mem_mode mode;
+	const char *path;	/* for MODE_FILE */
+	int populate, hugepage, unmap, nthreads, verbose;
+	int touch_all;		/* touch every page (and time it) */
+} cfg = {
+	.count = 0, .mode = MODE_MALLOC, .path = "oom_killer_try.dat",
+	.nthreads = 1, .touch_all = 1,
+};
 
 static int force_page_fault = 0;
+static int filefd = -1;
+static volatile sig_atomic_t stop;
 
-int main(int argc, char **argv)
+/* Per-thread statistics */
+struct thrd_stats {
+	int idx;
+	long blocks;
+	uint64_t faults_timed, lat_sum_ns, lat_max_ns, populate_ns;
+	uint64_t hist[NBUCKETS];
+	long minflt, majflt;
+	pthread_t tid;
+};
+
+static inline uint64_t now_ns(void)
 {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int log2_bucket(uint64_t ns)
+{
+	int b = 0;
+
+	while (ns >>= 1)
+		b++;
+	return b < NBUCKETS ? b : NBUCKETS - 1;
+}
+
+static void sighdlr(int sig)
+{
+	stop = 1;
+}
+
+static size_t parse_size(const char *s)
+{
+	char *end;
+	size_t v = strtoul(s, &end, 0);
+
+	switch (*end) {
+	case 'g': case 'G': v <<= 10;	/* fallthrough */
+	case 'm': case 'M': v <<= 10;	/* fallthrough */
+	case 'k': case 'K': v <<= 10;
+	}
+	return v;
+}
+
+/*
+ * Every mmap()'ed block - a file-backed one, always - is a VMA of it's own; a
+ * process can have at most vm.max_map_count of them. True if we're (about)
+ * there, i.e., that's why mmap() failed, not memory running out.
+ */
+static int map_count_exhausted(long *max)
+{
+	char buf[4096], *c;
+	long nmaps = 0;
+	ssize_t n;
+	int fd;
+
+	/* (plain read()s, no stdio: it'd need memory - an mmap() - itself) */
+	*max = 0;
+	fd = open("/proc/sys/vm/max_map_count", O_RDONLY);
+	if (fd < 0)
+		return 0;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return 0;
+	buf[n] = '\0';
+	*max = atol(buf);
+
+	fd = open("/proc/self/maps", O_RDONLY);
+	if (fd < 0)
+		return 0;
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		for (c = buf; c < buf + n; c++)
+			nmaps += (*c == '\n');
+	close(fd);
+	return *max && nmaps >= *max - 16;	/* (some slack for libc's own) */
+}
+
+/* Get one block of memory per the configured mode; NULL on failure */
+static char *get_block(struct thrd_stats *st, long blkidx)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	uint64_t t1;
+	off_t off;
 	char *p;
-	int i = 0, j = 1, stepval = 5000, verbose = 0;
 
-	if (argc < 3) {
-		fprintf(stderr,
-		"Usage: %s alloc-loop-count force-page-fault[0|1] [verbose_flag[0|1]]\n",
-			argv[0]);
-		exit(EXIT_FAILURE);
+	if (cfg.mode == MODE_MALLOC)
+		return malloc(cfg.blksz);
+
+	if (cfg.populate)
+		flags |= MAP_POPULATE;
+	t1 = now_ns();
+	if (cfg.mode == MODE_ANON)
+		p = mmap(NULL, cfg.blksz, PROT_READ | PROT_WRITE, flags, -1, 0);
+	else {
+		/* each thread owns a disjoint range of the (pre-sized) file */
+		off = ((off_t)st->idx * cfg.count + blkidx) * cfg.blksz;
+		flags = MAP_SHARED | (cfg.populate ? MAP_POPULATE : 0);
+		p = mmap(NULL, cfg.blksz, PROT_READ | PROT_WRITE, flags, filefd, off);
 	}
+	st->populate_ns += now_ns() - t1;
+	if (p == MAP_FAILED)
+		return NULL;
+	if (cfg.hugepage && madvise(p, cfg.blksz, MADV_HUGEPAGE) < 0 && cfg.verbose)
+		perror("madvise(MADV_HUGEPAGE)");
+	return p;
+}
 
-	if (atoi(argv[2]) == 1)
-		force_page_fault = 1;
+/*
+ * *IMPORTANT* Demand Paging :
+ * Force the MMU to raise the page fault exception by writing into the
+ * page; writing a single byte, any byte, will do the trick! This is as
+ * the virtual address referenced will have no PTE entry, causing the
+ * MMU to raise the page fault!
+ * The fault handler, being intelligent, figures out it's a "good fault"
+ * (a minor fault) and allocates a page frame via the page allocator!
+ * Only now do we have physical memory!
+ * Here, we touch every page of the block, timing each (first) touch.
+ */
+static void touch_block(struct thrd_stats *st, char *p)
+{
+	size_t pgsz = getpagesize(), off;
+	uint64_t t1, t2, lat;
 
-	if (argc >= 4) {
-		if (atoi(argv[3]) == 1)
-			verbose = 1;
+	for (off = 0; off < cfg.blksz; off += pgsz) {
+		t1 = now_ns();
+		p[off] |= 0xaa;
+		t2 = now_ns();
+		lat = t2 - t1;
+		st->hist[log2_bucket(lat)]++;
+		st->lat_sum_ns += lat;
+		if (lat > st->lat_max_ns)
+			st->lat_max_ns = lat;
+		st->faults_timed++;
 	}
+}
 
-	printf("%s: PID %d (verbose mode: %s)\n",
-		argv[0], getpid(), (verbose==1?"on":"off"));
-	do {
-		p = (char *)malloc(BLK);
+static void *pressure_thrd(void *arg)
+{
+	struct thrd_stats *st = arg;
+	struct rusage ru1, ru2;
+	long i;
+	char *p;
+
+	getrusage(RUSAGE_THREAD, &ru1);
+	for (i = 0; !stop && (!cfg.count || i < cfg.count); i++) {
+		p = get_block(st, i);
 		if (!p) {
-			fprintf(stderr, "%s: loop #%d: malloc failure.\n",
-				argv[0], i);
+			int err = errno;
+			long max;
+
+			if (cfg.mode != MODE_MALLOC && err == ENOMEM && map_count_exhausted(&max))
+				fprintf(stderr, "thread %d: block #%ld: mmap() failed: hit the vm.max_map_count"
+					" limit (%ld mappings), not memory pressure; use larger blocks (-b)"
+					" or -D\n", st->idx, i, max);
+			else
+				fprintf(stderr, "thread %d: block #%ld: allocation failure (%s).\n",
+					st->idx, i, strerror(err));
 			break;
 		}
-
-		/* *IMPORTANT* Demand Paging :
-		 * Force the MMU to raise the page fault exception by writing into the
-		 * page; writing a single byte, any byte, will do the trick! This is as
-		 * the virtual address referenced will have no PTE entry, causing the
-		 * MMU to raise the page fault!
-		 * The fault handler, being intelligent, figures out it's a "good fault"
-		 * (a minor fault) and allocates a page frame via the page allocator!
-		 * Only now do we have physical memory!
-		 */
-		if (force_page_fault) {
+		if (cfg.touch_all)
+			touch_block(st, p);
+		else if (force_page_fault) {
 			p[1103] &= 0x0b;  // write something into a byte of the 1st page
 			p[5227] |= 0xaa;  // write something into a byte of the 2nd page
 		}
-		if (!(i % stepval)) {	// every 'stepval' iterations..
-			if (!verbose) {
-				if (!(j%5))
-					printf(". ");
-				else
-					printf(".");
+		if (cfg.unmap && cfg.mode != MODE_MALLOC)
+			munmap(p, cfg.blksz);	/* frees the pages *and* the VMA */
+		if (!(i % 5000)) {	// every 5000 iterations..
+			if (cfg.verbose)	/* (just an address value; it may be unmapped) */
+				printf("thrd %d: %06ld\taddr p = %p\n", st->idx, i, (void *)p);
+			else {
+				printf(".");
 				fflush(stdout);
-				j++;
-			} else {
-				printf("%06d\taddr p = %p   break = %p\n",
-					i, (void *)p, (void *)sbrk(0));
 			}
 		}
-		i++;
-	} while (p && (i < atoi(argv[1])));
+		st->blocks++;
+	}
+	getrusage(RUSAGE_THREAD, &ru2);
+	st->minflt = ru2.ru_minflt - ru1.ru_minflt;
+	st->majflt = ru2.ru_majflt - ru1.ru_majflt;
+	return NULL;
+}
+
+static void report(struct thrd_stats *sts, uint64_t wall_ns)
+{
+	uint64_t hist[NBUCKETS] = { 0 }, nfaults = 0, sum = 0, max = 0, pop = 0, cum = 0;
+	long blocks = 0, minflt = 0, majflt = 0;
+	int t, b, p50 = -1, p99 = -1, p999 = -1;
+
+	for (t = 0; t < cfg.nthreads; t++) {
+		for (b = 0; b < NBUCKETS; b++)
+			hist[b] += sts[t].hist[b];
+		nfaults += sts[t].faults_timed;
+		sum += sts[t].lat_sum_ns;
+		pop += sts[t].populate_ns;
+		if (sts[t].lat_max_ns > max)
+			max = sts[t].lat_max_ns;
+		blocks += sts[t].blocks;
+		minflt += sts[t].minflt;
+		majflt += sts[t].majflt;
+	}
+
+	printf("\n%ld blocks of %zu KB (%.1f MB total) by %d thread(s) in %.3f s\n",
+		blocks, cfg.blksz >> 10, (double)blocks * cfg.blksz / (1 << 20),
+		cfg.nthreads, wall_ns / 1e9);
+	printf("page faults: %ld minor, %ld major => %.0f faults/s\n",
+		minflt, majflt, (minflt + majflt) / (wall_ns / 1e9));
+	if (cfg.mode != MODE_MALLOC)
+		printf("time in mmap()%s: %.3f ms\n",
+			cfg.populate ? " (incl. MAP_POPULATE faulting)" : "", pop / 1e6);
+	if (!nfaults)
+		return;
+
+	printf("per-page first-touch latency: %lu touches, avg %lu ns, max %lu ns\n",
+		(unsigned long)nfaults, (unsigned long)(sum / nfaults), (unsigned long)max);
+	printf("   latency range (ns)   :      count  (cum %%)\n");
+	for (b = 0; b < NBUCKETS; b++) {
+		if (!hist[b])
+			continue;
+		cum += hist[b];
+		if (p50 < 0 && cum * 100 >= nfaults * 50)
+			p50 = b;
+		if (p99 < 0 && cum * 100 >= nfaults * 99)
+			p99 = b;
+		if (p999 < 0 && cum * 1000 >= nfaults * 999)
+			p999 = b;
+		printf(" [%9llu, %9llu) : %10lu  (%6.2f)\n", 1ULL << b, 1ULL << (b + 1),
+			(unsigned long)hist[b], 100.0 * cum / nfaults);
+	}
+	printf("p50 < %llu ns, p99 < %llu ns, p99.9 < %llu ns\n",
+		1ULL << (p50 + 1), 1ULL << (p99 + 1), 1ULL << (p999 + 1));
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+	"Usage: %s alloc-loop-count force-page-fault[0|1] [verbose_flag[0|1]]\n"
+	"  (the original usage: malloc() 2-page blocks, optionally touching 2 bytes)\n"
+	"or: %s [options]\n"
+	"  -n count   # of blocks to allocate per thread (default 0: until failure / OOM)\n"
+	"  -b size    block size; k/m/g suffixes ok (default 2 pages)\n"
+	"  -m mode    malloc | anon | file (default malloc)\n"
+	"  -f path    the file to map in 'file' mode (default ./oom_killer_try.dat; needs -n)\n"
+	"  -P         mmap() with MAP_POPULATE (anon|file modes)\n"
+	"  -H         madvise(MADV_HUGEPAGE) on each block (anon mode)\n"
+	"  -D         munmap() each block after touching it (anon|file modes): a sustained\n"
+	"             fault load instead of an ever-growing footprint (or map count)\n"
+	"  -j threads # of threads faulting concurrently (default 1)\n"
+	"  -v         verbose\n", name, name);
+}
+
+int main(int argc, char **argv)
+{
+	struct thrd_stats *sts;
+	uint64_t t1, t2;
+	int opt, t;
+
+	cfg.blksz = BLK;
+	if (argc < 2) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (argv[1][0] != '-') {
+		/* The original (positional) usage */
+		if (argc < 3) {
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		cfg.count = atol(argv[1]);
+		if (atoi(argv[2]) == 1)
+			force_page_fault = 1;
+		if (argc >= 4 && atoi(argv[3]) == 1)
+			cfg.verbose = 1;
+		cfg.touch_all = 0;
+		if (cfg.count <= 0)
+			cfg.count = 1;
+	} else {
+		while ((opt = getopt(argc, argv, "n:b:m:f:PHDj:vh")) != -1) {
+			switch (opt) {
+			case 'n':
+				cfg.count = atol(optarg);
+				break;
+			case 'b':
+				cfg.blksz = parse_size(optarg);
+				break;
+			case 'm':
+				if (!strcmp(optarg, "malloc"))
+					cfg.mode = MODE_MALLOC;
+				else if (!strcmp(optarg, "anon"))
+					cfg.mode = MODE_ANON;
+				else if (!strcmp(optarg, "file"))
+					cfg.mode = MODE_FILE;
+				else {
+					usage(argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'f':
+				cfg.path = optarg;
+				break;
+			case 'P':
+				cfg.populate = 1;
+				break;
+			case 'H':
+				cfg.hugepage = 1;
+				break;
+			case 'D':
+				cfg.unmap = 1;
+				break;
+			case 'j':
+				cfg.nthreads = atoi(optarg);
+				break;
+			case 'v':
+				cfg.verbose = 1;
+				break;
+			default:
+				usage(argv[0]);
+				exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+			}
+		}
+	}
+	if (!cfg.blksz || cfg.nthreads <= 0 || cfg.count < 0) {
+		fprintf(stderr, "%s: invalid block size, thread count or block count\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (cfg.mode != MODE_MALLOC)	/* mmap() granularity */
+		cfg.blksz = (cfg.blksz + getpagesize() - 1) & ~((size_t)getpagesize() - 1);
+
+	if (cfg.mode == MODE_FILE) {
+		if (!cfg.count) {
+			fprintf(stderr, "%s: 'file' mode requires a block count (-n)\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		filefd = open(cfg.path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (filefd < 0) {
+			perror("open");
+			exit(EXIT_FAILURE);
+		}
+		if (ftruncate(filefd, (off_t)cfg.nthreads * cfg.count * cfg.blksz) < 0) {
+			perror("ftruncate");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	sts = calloc(cfg.nthreads, sizeof(struct thrd_stats));
+	if (!sts) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	signal(SIGINT, sighdlr);
+	signal(SIGTERM, sighdlr);
+
+	printf("%s: PID %d (verbose mode: %s)\n",
+		argv[0], getpid(), (cfg.verbose==1?"on":"off"));
+	t1 = now_ns();
+	for (t = 0; t < cfg.nthreads; t++) {
+		sts[t].idx = t;
+		if (pthread_create(&sts[t].tid, NULL, pressure_thrd, &sts[t])) {
+			fprintf(stderr, "%s: pthread_create failed\n", argv[0]);
+			cfg.nthreads = t;
+			stop = 1;
+			break;
+		}
+	}
+	for (t = 0; t < cfg.nthreads; t++)
+		pthread_join(sts[t].tid, NULL);
+	t2 = now_ns();
 
+	report(sts, t2 - t1);
+	if (filefd >= 0) {
+		close(filefd);
+		unlink(cfg.path);
+	}
 	exit(EXIT_SUCCESS);
 }
@@ -15,6 +15,10 @@
  * custom slab cache. We deliberately introduce a UAF (Use After Free) memory
  * bug; it is indeed caught by the kernel SLUB debug code - provided of course
  * that SLUB debug is enabled.
+ * Alternatively, pass 'guard_rate=N' to route our cache's allocations through
+ * our klib_llkd sampling UAF guard: one in N objects then lives on it's own
+ * page, unmapped on free, so the UAF faults (Oops-es) right at the offending
+ * access - even without SLUB debug (with N=1, every object is guarded).
  *
  * For details, please refer the book, Ch 9.
  */
@@ -26,6 +30,7 @@
 #include <linux/slab.h>
 #include <linux/version.h>
 #include <linux/sched.h>	/* current */
+#include "../../klib_llkd.h"
 
 #define OURMODNAME   "poison_test"
 #define OURCACHENAME "poison_test"
@@ -35,6 +40,22 @@ module_param(use_ctor, uint, 0);
 MODULE_PARM_DESC(use_ctor, "if set to 1, our custom ctor routine"
 " will initialize slabmem; when 0, no custom constructor will run");
 
+static int poison = 1;
+module_param(poison, int, 0);
+MODULE_PARM_DESC(poison, "if 1 (default), create our cache with SLAB_POISON");
+
+static int redzone = 1;
+module_param(redzone, int, 0);
+MODULE_PARM_DESC(redzone, "if 1 (default), create our cache with SLAB_RED_ZONE");
+
+static int hwalign = 1;
+module_param(hwalign, int, 0);
+MODULE_PARM_DESC(hwalign, "if 1 (default), create our cache with SLAB_HWCACHE_ALIGN");
+
+static uint guard_rate;
+module_param(guard_rate, uint, 0);
+MODULE_PARM_DESC(guard_rate, "if N > 0, one in N allocations is guarded by the klib_llkd sampling UAF detector (default=0: off)");
+
 MODULE_AUTHOR("Kaiwan N Billimoria");
 MODULE_DESCRIPTION("LKP book:ch9/poison_test: simple demo of creating a custom slab cache");
 MODULE_LICENSE("Dual MIT/GPL");
@@ -50,6 +71,7 @@ struct myctx {
 	char config[64];
 };
 static struct kmem_cache *gctx_cachep;
+static struct llkd_guard_cache *gguard;
 struct myctx *obj;
 
 static void use_the_object(void *s, u8 c, size_t n)
@@ -68,13 +90,17 @@ static void use_our_cache(void)
 	pr_debug("[ker ver > 2.6.38 cache name deprecated...]\n");
 #endif
 
-	obj = kmem_cache_alloc(gctx_cachep, GFP_KERNEL);
+	if (gguard)
+		obj = llkd_guard_alloc(gguard, GFP_KERNEL);
+	else
+		obj = kmem_cache_alloc(gctx_cachep, GFP_KERNEL);
 	if (!obj) {		/* pedantic warning printk below... */
 		pr_warn("kmem_cache_alloc() failed\n");
 	}
 
 	pr_info("Our cache object (@ 0x%pK, actual=0x%px) size is %u bytes; ksize=%zu\n",
-		obj, obj, kmem_cache_size(gctx_cachep), ksize(obj));
+		obj, obj, kmem_cache_size(gctx_cachep),
+		is_vmalloc_addr(obj) ? 0 : ksize(obj));	/* guarded objects aren't slab memory */
 	print_hex_dump_bytes("obj: ", DUMP_PREFIX_OFFSET, obj, sizeof(struct myctx));
 
 	use_the_object(obj, 'z', 16);
@@ -108,8 +134,12 @@ static int create_our_cache(void)
 		ctor_fn = our_ctor;
 
 	pr_info("sizeof our ctx structure is %zu bytes\n"
-		" using custom constructor routine? %s\n",
-		sizeof(struct myctx), use_ctor == 1 ? "yes" : "no");
+		" using custom constructor routine? %s\n"
+		" flags: poison=%d redzone=%d hwalign=%d\n",
+		sizeof(struct myctx), use_ctor == 1 ? "yes" : "no",
+		!!poison, !!redzone, !!hwalign);
+	if (!poison)
+		pr_info(" (without SLAB_POISON, the UAF on removal will likely go undetected!)\n");
 
 	/* Create a new slab cache:
 	 * kmem_cache_create(const char *name, unsigned int size, unsigned int align,
@@ -118,9 +148,9 @@ static int create_our_cache(void)
 	gctx_cachep = kmem_cache_create(OURCACHENAME,
 					sizeof(struct myctx), // (min) size of each object
 					sizeof(long),		  // alignment
-					SLAB_POISON |   /* the whole point here */
-					SLAB_RED_ZONE | /* good for catching buffer under|over-flow bugs */
-					SLAB_HWCACHE_ALIGN, /* good for performance */
+					(poison ? SLAB_POISON : 0) |   /* the whole point here */
+					(redzone ? SLAB_RED_ZONE : 0) | /* good for catching buffer under|over-flow bugs */
+					(hwalign ? SLAB_HWCACHE_ALIGN : 0), /* good for performance */
 					ctor_fn);	// ctor: NULL by default
 	if (!gctx_cachep) {
 		/* When a mem alloc fails we'll usually not require a warning
@@ -130,6 +160,13 @@ static int create_our_cache(void)
 		pr_warn("kmem_cache_create() failed\n");
 		if (IS_ERR(gctx_cachep))
 			ret = PTR_ERR(gctx_cachep);
+		return ret;
+	}
+
+	if (guard_rate) {
+		gguard = llkd_guard_create(gctx_cachep, ctor_fn, guard_rate, 16);
+		if (!gguard)
+			pr_warn("llkd_guard_create() failed, continuing unguarded\n");
 	}
 
 	return ret;
@@ -145,9 +182,16 @@ static int __init slab_custom_init(void)
 
 static void __exit slab_custom_exit(void)
 {
-	kmem_cache_free(gctx_cachep, obj);
+	if (gguard)
+		llkd_guard_free(gguard, obj);
+	else
+		kmem_cache_free(gctx_cachep, obj);
 	use_the_object(obj, '!', 10);		/* the (here pretty obvious) UAF BUG ! */
 
+	if (gguard) {
+		llkd_guard_show_stats(gguard);
+		llkd_guard_destroy(gguard);
+	}
 	kmem_cache_destroy(gctx_cachep);
 	pr_info("custom cache destroyed; removed\n");
 }
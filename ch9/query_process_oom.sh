@@ -14,6 +14,8 @@
 # Just a simple wrapper around choom(1).
 # Tip: One can always arrange to sort the output by OOM score; f.e.:
 #  /query_task_oom.sh |sed '1d' |sort -k3n
+# Note: this forks several processes per process alive; on a large system, use
+# the (much faster, single-pass) C version instead: query_process_oom/
 # Details: refer to the LKP book, Ch 9
 i=1
 printf "  PID                      Name         OOM Score\n"
@@ -0,0 +1,162 @@
+/*
+ * ch9/vmalloc_demo/mmap_test.c
+ ***************************************************************
+ * This program is part of the source code released for the book
+ *  "Linux Kernel Programming"
+ *  (c) Author: Kaiwan N Billimoria
+ *  Publisher:  Packt
+ *  GitHub repository:
+ *  https://github.com/PacktPublishing/Linux-Kernel-Programming
+ *
+ * From: Ch 9 : Kernel Memory Allocation for Module Authors Part 2
+ ****************************************************************
+ * Brief Description:
+ * A small *userspace* test app for the vmalloc_demo LKM's zero-copy device,
+ * /dev/llkd_vmalloc_mmap. We:
+ *  - mmap() the kernel's vmalloc_user() buffer and verify - in place, without
+ *    any copying - the pattern the driver filled it with
+ *  - then measure the throughput of consuming the whole buffer (summing it's
+ *    words) via the mapping vs via read(2)/pread(2) copies, over 'loops'
+ *    iterations.
+ * Usage:
+ *  sudo insmod ./vmalloc_demo.ko [mmap_kb=n]
+ *  ./mmap_test [loops]
+ *
+ * For details, please refer the book, Ch 9.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#define DEVNODE      "/dev/llkd_vmalloc_mmap"
+#define PARAM_FILE   "/sys/module/vmalloc_demo/parameters/mmap_kb"
+#define CHUNK        (256 * 1024)
+
+/* Must match the kernel module's MMAP_PATTERN() */
+#define MMAP_PATTERN(i)   ((uint32_t)(i) ^ 0xa5a5a5a5)
+
+static volatile uint64_t sink;
+
+static inline double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t sum_words(const uint32_t *w, size_t nwords)
+{
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < nwords; i++)
+		sum += w[i];
+	return sum;
+}
+
+static size_t get_buflen(void)
+{
+	FILE *fp = fopen(PARAM_FILE, "r");
+	long kb = 0, pgsz = sysconf(_SC_PAGESIZE);
+
+	if (!fp) {
+		perror("fopen " PARAM_FILE " (is the vmalloc_demo LKM loaded?)");
+		return 0;
+	}
+	if (fscanf(fp, "%ld", &kb) != 1)
+		kb = 0;
+	fclose(fp);
+	/* the driver page-aligns it */
+	return ((kb * 1024 + pgsz - 1) / pgsz) * pgsz;
+}
+
+int main(int argc, char **argv)
+{
+	size_t len, i, nwords, off;
+	int fd, loops = 20, l;
+	uint32_t *map, *buf;
+	double t1, t2, mb;
+	ssize_t n;
+
+	if (argc > 1 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help"))) {
+		fprintf(stderr, "Usage: %s [loops]\n", argv[0]);
+		exit(EXIT_SUCCESS);
+	}
+	if (argc > 1)
+		loops = atoi(argv[1]);
+	if (loops <= 0)
+		loops = 1;
+
+	len = get_buflen();
+	if (!len)
+		exit(EXIT_FAILURE);
+	nwords = len / sizeof(uint32_t);
+	mb = (double)len * loops / (1024 * 1024);
+
+	fd = open(DEVNODE, O_RDONLY);
+	if (fd < 0) {
+		perror("open " DEVNODE);
+		exit(EXIT_FAILURE);
+	}
+
+	/* 1. Zero-copy: map the kernel buffer and verify it in place */
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < nwords; i++) {
+		if (map[i] != MMAP_PATTERN(i)) {
+			fprintf(stderr, "FAIL: word %zu is 0x%08x, expected 0x%08x\n",
+				i, map[i], MMAP_PATTERN(i));
+			exit(EXIT_FAILURE);
+		}
+	}
+	printf("mmap verify: OK, %zu KB match the kernel's pattern\n", len >> 10);
+
+	/* 2. Throughput: consume the buffer via the mapping ... */
+	t1 = now_sec();
+	for (l = 0; l < loops; l++)
+		sink += sum_words(map, nwords);
+	t2 = now_sec();
+	printf("mmap   : %9.1f MB/s (%d x %zu KB)\n", mb / (t2 - t1), loops, len >> 10);
+
+	/* ... and via read(2) copies into a userspace buffer */
+	buf = malloc(len);
+	if (!buf) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	t1 = now_sec();
+	for (l = 0; l < loops; l++) {
+		for (off = 0; off < len; off += n) {
+			n = pread(fd, (char *)buf + off, (len - off) < CHUNK ? (len - off) : CHUNK, off);
+			if (n <= 0) {
+				perror("pread");
+				exit(EXIT_FAILURE);
+			}
+		}
+		sink += sum_words(buf, nwords);
+	}
+	t2 = now_sec();
+	printf("read(2): %9.1f MB/s (%d x %zu KB, %d KB chunks)\n",
+		mb / (t2 - t1), loops, len >> 10, CHUNK >> 10);
+	if (memcmp(buf, map, len)) {
+		fprintf(stderr, "FAIL: read(2) data differs from the mapping\n");
+		exit(EXIT_FAILURE);
+	}
+
+	free(buf);
+	munmap(map, len);
+	close(fd);
+	exit(EXIT_SUCCESS);
+}
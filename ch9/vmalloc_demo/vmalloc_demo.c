@@ -13,6 +13,23 @@
  * Brief Description:
  * A simple demo of using the vmalloc() and friends...
  *
+ * Benchmark mode (module parameter bench=1):
+ * for sizes from 4 KB to 'bench_maxmb' MB (in powers of 4), time the
+ * allocation and free, then sequential and random (cacheline granularity)
+ * read access over the buffer, for each of vmalloc(), kvmalloc() and - on
+ * 5.18+ kernels - the huge-page-backed vmalloc_huge(). The random vs
+ * sequential access cost (and, where the PMU allows, the dTLB load misses)
+ * shows the TLB-miss-driven penalty of each kind of mapping.
+ *
+ * Zero-copy sharing with userspace:
+ * we also register a misc device, /dev/llkd_vmalloc_mmap, backed by an
+ * 'mmap_kb' KB vmalloc_user() buffer that we fill with a known pattern.
+ * Its mmap method maps the buffer straight into the process via
+ * remap_vmalloc_range() - no copying - while its read method copies it out
+ * the usual way (copy_to_user()), for comparison. The userspace mmap_test
+ * app (in this directory) verifies the pattern and measures the throughput
+ * of both.
+ *
  * For details, please refer the book, Ch 9.
  */
 #define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
@@ -23,6 +40,12 @@
 #include <linux/mm.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
+#include <linux/perf_event.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
 
 #define OURMODNAME   "vmalloc_demo"
 
@@ -35,6 +58,18 @@ static int kvnum = 5 * 1024 * 1024;	// 5 MB
 module_param(kvnum, int, 0644);
 MODULE_PARM_DESC(kvnum, "number of bytes to allocate with the kvmalloc(); (defaults to 5 MB)");
 
+static int bench;
+module_param(bench, int, 0444);
+MODULE_PARM_DESC(bench, "if 1, run the vmalloc vs kvmalloc vs huge-vmalloc benchmark (default 0)");
+
+static int bench_maxmb = 1024;
+module_param(bench_maxmb, int, 0444);
+MODULE_PARM_DESC(bench_maxmb, "largest allocation size the benchmark tries, in MB (default 1024; capped to 1/4 of RAM)");
+
+static int mmap_kb = 4096;
+module_param(mmap_kb, int, 0444);
+MODULE_PARM_DESC(mmap_kb, "size (in KB) of the mmap-able vmalloc_user() buffer behind /dev/llkd_vmalloc_mmap (default 4096; 0 = no device)");
+
 #define KVN_MIN_BYTES   16
 #define DISP_BYTES      16
 
@@ -120,24 +155,265 @@ static int vmalloc_try(void)
 	return -ENOMEM;
 }
 
-static int __init vmalloc_demo_init(void)
+/*------------------------ the benchmark ---------------------------------*/
+enum bench_alloc { B_VMALLOC = 0, B_KVMALLOC, B_VHUGE, B_MAX };
+static const char *bench_name[B_MAX] = { "vmalloc", "kvmalloc", "vmalloc_huge" };
+
+static void *bench_alloc(enum bench_alloc type, size_t sz)
 {
-	if (kvnum < KVN_MIN_BYTES) {
-		pr_info("kvnum must be >= %d bytes (curr it's %d bytes)\n", KVN_MIN_BYTES, kvnum);
+	switch (type) {
+	case B_VMALLOC:
+		return vmalloc(sz);
+	case B_KVMALLOC:
+		return kvmalloc(sz, GFP_KERNEL | __GFP_NOWARN);
+	case B_VHUGE:
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+		/* only actually huge-mapped for sizes >= PMD_SIZE on arches
+		 * with CONFIG_HAVE_ARCH_HUGE_VMALLOC */
+		return vmalloc_huge(sz, GFP_KERNEL);
+#else
+		return NULL;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+/* dTLB load misses of the current task, kernel-mode only; NULL if unsupported */
+static struct perf_event *dtlb_counter_create(void)
+{
+	struct perf_event_attr attr = {
+		.type = PERF_TYPE_HW_CACHE,
+		.config = PERF_COUNT_HW_CACHE_DTLB |
+			  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+		.size = sizeof(struct perf_event_attr),
+		.exclude_user = 1,
+		.exclude_hv = 1,
+	};
+	struct perf_event *ev;
+
+	ev = perf_event_create_kernel_counter(&attr, -1, current, NULL, NULL);
+	return IS_ERR(ev) ? NULL : ev;
+}
+
+static u64 dtlb_read(struct perf_event *ev)
+{
+	u64 enabled, running;
+
+	return ev ? perf_event_read_value(ev, &enabled, &running) : 0;
+}
+
+static u64 bench_sink;	/* keeps the compiler from eliding our reads */
+
+/*
+ * Read one u64 per cacheline over @buf (@sz bytes), sequentially or at
+ * (xorshift) pseudo-random cachelines; returns the number of accesses made.
+ */
+static u64 access_buf(const u8 *buf, size_t sz, bool random)
+{
+	u64 i, nlines = sz / L1_CACHE_BYTES, x = 0x9e3779b97f4a7c15ULL, sum = 0, line;
+	size_t off;
+
+	for (i = 0; i < nlines; i++) {
+		if (random) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			div64_u64_rem(x, nlines, &line);
+			off = (size_t)line * L1_CACHE_BYTES;
+		} else
+			off = (size_t)i * L1_CACHE_BYTES;
+		sum += READ_ONCE(*(const u64 *)(buf + off));
+		if (!(i & 0xffff))
+			cond_resched();
+	}
+	bench_sink += sum;
+	return nlines;
+}
+
+static void bench_one(enum bench_alloc type, size_t sz, struct perf_event *ev)
+{
+	u64 t1, t2, t3, t4, t5, m1, m2, m3, nacc;
+	u64 seq_ps, rnd_ps, seq_ns, rnd_ns, seq_frac, rnd_frac;
+	void *p;
+
+	t1 = ktime_get_ns();
+	p = bench_alloc(type, sz);
+	t2 = ktime_get_ns();
+	if (!p) {
+		pr_info("%-12s %10zu KB : alloc failed%s\n", bench_name[type], sz >> 10,
+			LINUX_VERSION_CODE < KERNEL_VERSION(5, 18, 0) && type == B_VHUGE ?
+			" (vmalloc_huge() needs 5.18+)" : "");
+		return;
+	}
+	memset(p, 0x5a, sz);	/* (untimed) first touch */
+
+	m1 = dtlb_read(ev);
+	t3 = ktime_get_ns();
+	nacc = access_buf(p, sz, false);
+	t4 = ktime_get_ns();
+	m2 = dtlb_read(ev);
+	access_buf(p, sz, true);
+	t5 = ktime_get_ns();
+	m3 = dtlb_read(ev);
+
+	t1 = t2 - t1;	/* alloc time */
+	t2 = ktime_get_ns();
+	kvfree(p);	/* works for all of them */
+	t2 = ktime_get_ns() - t2;	/* free time */
+
+	if (!nacc) {		/* (can't be, the buffer's >= a page, but still) */
+		pr_info("%-12s %10zu KB : no accesses made\n", bench_name[type], sz >> 10);
+		return;
+	}
+	seq_ps = div64_u64((t4 - t3) * 1000, nacc);	/* per access */
+	rnd_ps = div64_u64((t5 - t4) * 1000, nacc);
+	/* (div64 helpers throughout: no raw 64-bit / or % on 32-bit) */
+	seq_ns = div64_u64_rem(seq_ps, 1000, &seq_frac);
+	rnd_ns = div64_u64_rem(rnd_ps, 1000, &rnd_frac);
+	pr_info("%-12s %10zu KB : alloc %9llu ns free %9llu ns : seq %5llu.%03llu rnd %5llu.%03llu ns/access (penalty x%llu)",
+		bench_name[type], sz >> 10, t1, t2, seq_ns, seq_frac, rnd_ns, rnd_frac,
+		seq_ps ? div64_u64(rnd_ps, seq_ps) : 0);
+	if (ev)
+		pr_cont(" : dTLB misses/1k accesses seq %llu rnd %llu\n",
+			div64_u64((m2 - m1) * 1000, nacc), div64_u64((m3 - m2) * 1000, nacc));
+	else
+		pr_cont("\n");
+}
+
+static void vmalloc_bench(void)
+{
+	size_t sz, maxsz = (size_t)bench_maxmb << 20;
+	size_t ramcap = (totalram_pages() / 4) << PAGE_SHIFT;
+	struct perf_event *ev;
+	int type;
+
+	if (maxsz > ramcap)
+		maxsz = ramcap;
+	ev = dtlb_counter_create();
+	pr_info("benchmark: sizes 4 KB .. %zu MB; dTLB miss counting %s\n",
+		maxsz >> 20, ev ? "on" : "unavailable");
+	for (sz = PAGE_SIZE; sz && sz <= maxsz; sz <<= 2)
+		for (type = 0; type < B_MAX; type++)
+			bench_one(type, sz, ev);
+	if (ev)
+		perf_event_release_kernel(ev);
+}
+
+/*------------------ zero-copy mmap of a vmalloc buffer ------------------*/
+static void *mmap_buf;
+static size_t mmap_len;
+
+/* The pattern: each u32 word holds (it's index ^ 0xa5a5a5a5); mmap_test relies on it */
+#define MMAP_PATTERN(i)   ((u32)(i) ^ 0xa5a5a5a5)
+
+static int mmap_vmdemo(struct file *filp, struct vm_area_struct *vma)
+{
+	unsigned long len = vma->vm_end - vma->vm_start;
+	unsigned long off = vma->vm_pgoff << PAGE_SHIFT;
+
+	if (off >= mmap_len || len > mmap_len - off)
 		return -EINVAL;
+	/* Maps the (VM_USERMAP) vmalloc_user() pages directly; also sets
+	 * VM_DONTEXPAND | VM_DONTDUMP on the vma */
+	return remap_vmalloc_range(vma, mmap_buf, vma->vm_pgoff);
+}
+
+static ssize_t read_vmdemo(struct file *filp, char __user *ubuf, size_t count, loff_t *off)
+{
+	if (*off >= mmap_len)
+		return 0;
+	if (count > mmap_len - *off)
+		count = mmap_len - *off;
+	if (copy_to_user(ubuf, mmap_buf + *off, count))
+		return -EFAULT;
+	*off += count;
+	return count;
+}
+
+static const struct file_operations vmdemo_fops = {
+	.owner = THIS_MODULE,
+	.read = read_vmdemo,
+	.mmap = mmap_vmdemo,
+	.llseek = default_llseek,
+};
+
+static struct miscdevice vmdemo_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "llkd_vmalloc_mmap",
+	.mode = 0444,
+	.fops = &vmdemo_fops,
+};
+
+static int mmap_dev_setup(void)
+{
+	u32 *w;
+	size_t i;
+	int ret;
+
+	mmap_len = PAGE_ALIGN((size_t)mmap_kb << 10);
+	/* vmalloc_user(): zeroed, and marked (VM_USERMAP) as OK to map to userspace */
+	mmap_buf = vmalloc_user(mmap_len);
+	if (!mmap_buf)
+		return -ENOMEM;
+	for (w = mmap_buf, i = 0; i < mmap_len / sizeof(u32); i++)
+		w[i] = MMAP_PATTERN(i);
+
+	ret = misc_register(&vmdemo_miscdev);
+	if (ret < 0) {
+		pr_notice("misc device registration failed\n");
+		vfree(mmap_buf);
+		mmap_buf = NULL;
+		return ret;
 	}
-	pr_info("inserted\n");
+	pr_info("/dev/%s: %zu KB vmalloc_user() buffer, mmap-able\n",
+		vmdemo_miscdev.name, mmap_len >> 10);
+	return 0;
+}
 
-	return vmalloc_try();
+static void mmap_dev_teardown(void)
+{
+	if (!mmap_buf)
+		return;
+	misc_deregister(&vmdemo_miscdev);
+	vfree(mmap_buf);
 }
 
-static void __exit vmalloc_demo_exit(void)
+static void vmalloc_demo_free(void)
 {
 	vfree(vrx);
 	kvfree(kvarr);
 	kvfree(kv);
 	vfree(vptr_init);
 	vfree(vptr_rndm);
+}
+
+static int __init vmalloc_demo_init(void)
+{
+	int ret;
+
+	if (kvnum < KVN_MIN_BYTES) {
+		pr_info("kvnum must be >= %d bytes (curr it's %d bytes)\n", KVN_MIN_BYTES, kvnum);
+		return -EINVAL;
+	}
+	pr_info("inserted\n");
+
+	if (bench && bench_maxmb > 0)
+		vmalloc_bench();
+	ret = vmalloc_try();
+	if (ret < 0 || mmap_kb <= 0)
+		return ret;
+	ret = mmap_dev_setup();
+	if (ret < 0)
+		vmalloc_demo_free();
+	return ret;
+}
+
+static void __exit vmalloc_demo_exit(void)
+{
+	mmap_dev_teardown();
+	vmalloc_demo_free();
 	pr_info("removed\n");
 }
 
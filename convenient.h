@@ -25,45 +25,156 @@
 /*
  *** PLEASE READ this first ***
  *
- *  We can reduce the load, and increase readability, by using the trace_printk
- *  instead of printk. To see the trace_printk() output do:
- *     cat /sys/kernel/debug/tracing/trace
+ *  DBGPRINT() - and thus MSG() and MSG_SHORT() - are 'dynamic': each call site
+ *  is guarded by it's own static key (jump label), via the kernel's dynamic
+ *  debug facility (CONFIG_DYNAMIC_DEBUG); while a site is disabled, all it
+ *  costs is a NOP in the instruction stream. Sites start out enabled if DEBUG
+ *  is defined, else disabled. Toggle them at runtime via debugfs, f.e.:
+ *     echo 'module <modname> +p' > /sys/kernel/debug/dynamic_debug/control
+ *     echo 'file foo.c line 42 -p' > /sys/kernel/debug/dynamic_debug/control
+ *     grep <modname> /sys/kernel/debug/dynamic_debug/control  # list them
+ *  (Without dynamic debug support in the kernel, every site is always on.)
  *
- *  If we insist on using the regular printk, lets at least rate-limit it.
- *	For the programmers' convenience, this too is programatically controlled
- *	(by an integer var USE_RATELIMITING [default: On]).
- *
- *** Kernel module authors Note: ***
- *	To use the trace_printk(), pl #define the symbol USE_FTRACE_PRINT in your
- *	Makefile:
- *	 EXTRA_CFLAGS += -DUSE_FTRACE_PRINT
- *	If you do not do this, we will use the usual printk() .
+ *  Where the output goes - the 'backend' - is selectable at runtime too, via
+ *  the module parameter dbg_backend; to have it, invoke LKP_DBG_DEFINE_PARAM();
+ *  once, at file scope, in your module's main source file (in a multi-file
+ *  module, it governs that file's DBGPRINT()s; the others use the default):
+ *     echo printk > /sys/module/<modname>/parameters/dbg_backend
+ *   ratelimit : printk, rate-limited [default]
+ *   printk    : the regular printk
+ *   trace     : the FTRACE-style trace_printk(); reduces the load and keeps
+ *               the kernel log readable. Compile time opt-in: define
+ *               LKP_DBG_TRACE_PRINTK (f.e. EXTRA_CFLAGS += -DLKP_DBG_TRACE_PRINTK)
+ *               to have it, else 'trace' is refused
+ *   blog      : klib_llkd's per-CPU lockless binary log - the cheapest, for
+ *               high rate logging; formatted only when read. To have it, link
+ *               in klib_llkd, #include "klib_llkd.h" *before* us, and point
+ *               lkp_dbg_blog at a log in your init code, f.e.:
+ *                 lkp_dbg_blog = llkd_blog_create(KBUILD_MODNAME, 0);
+ *               (read it via /sys/kernel/debug/<modname>/log); until then,
+ *               'blog' behaves as 'ratelimit'
  *
  *	To view :
  *	  printk's       : dmesg
  *     trace_printk's : cat /sys/kernel/debug/tracing/trace
  *
- *	 Default: printk (with rate-limiting)
+ *  (trace_printk() isn't meant for production kernels - a module using it
+ *  triggers the kernel's 'trace_printk() being used' notice and has the trace
+ *  buffers allocated when loaded - which is why, by default, we never
+ *  reference it.)
  */
-/* Keep this defined to use the FTRACE-style trace_printk(), else will use
- * regular printk()
+#include <linux/moduleparam.h>
+#include <linux/dynamic_debug.h>
+
+enum lkp_dbg_backend {
+	LKP_DBG_RATELIMIT = 0,
+	LKP_DBG_PRINTK,
+	LKP_DBG_TRACE,
+	LKP_DBG_BLOG,
+};
+static const char * const lkp_dbg_backend_names[] __maybe_unused = {
+	"ratelimit", "printk", "trace", "blog"
+};
+static int lkp_dbg_backend __attribute__((unused)) = LKP_DBG_RATELIMIT;
+
+static int __maybe_unused lkp_dbg_backend_set(const char *val, const struct kernel_param *kp)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(lkp_dbg_backend_names); i++) {
+#ifndef LKP_DBG_TRACE_PRINTK
+		if (i == LKP_DBG_TRACE)		/* not built in */
+			continue;
+#endif
+		if (sysfs_streq(val, lkp_dbg_backend_names[i])) {
+			WRITE_ONCE(lkp_dbg_backend, i);
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static int __maybe_unused lkp_dbg_backend_get(char *buf, const struct kernel_param *kp)
+{
+	return scnprintf(buf, PAGE_SIZE, "%s\n",
+			 lkp_dbg_backend_names[READ_ONCE(lkp_dbg_backend)]);
+}
+
+/*
+ * The dbg_backend module parameter; opt-in (it's not defined in the header
+ * itself, else every file including us would register it - twice over in a
+ * multi-file module, failing it's load). Invoke once, at file scope.
  */
-//#define USE_FTRACE_BUFFER
-#undef USE_FTRACE_BUFFER
+#define LKP_DBG_DEFINE_PARAM()                                          \
+static const struct kernel_param_ops lkp_dbg_backend_ops = {            \
+	.set = lkp_dbg_backend_set,                                         \
+	.get = lkp_dbg_backend_get,                                         \
+};                                                                      \
+module_param_cb(dbg_backend, &lkp_dbg_backend_ops, &lkp_dbg_backend, 0644); \
+MODULE_PARM_DESC(dbg_backend,                                           \
+"where DBGPRINT()/MSG() output goes: ratelimit (rate-limited printk) [default], printk, trace (trace_printk; only if built with LKP_DBG_TRACE_PRINTK) or blog (klib_llkd per-CPU binary log)")
 
-#ifdef USE_FTRACE_BUFFER
-#define DBGPRINT(string, args...)                                       \
-	trace_printk(string, ##args);
+#ifndef fallthrough		/* (pre 5.4 kernels) */
+#define fallthrough do {} while (0)
+#endif
+
+#ifdef LKP_DBG_TRACE_PRINTK
+#define LKP_DBG_TRACE_EMIT(string, args...) trace_printk(string, ##args)
+#define LKP_DBG_DUMP_STACK() do {                                       \
+	if (READ_ONCE(lkp_dbg_backend) == LKP_DBG_TRACE)                    \
+		trace_dump_stack(0);                                            \
+	else                                                                \
+		dump_stack();                                                   \
+} while (0)
 #else
-#define DBGPRINT(string, args...) do {                                  \
-	int USE_RATELIMITING = 1;                                           \
-	if (USE_RATELIMITING) {                                             \
+#define LKP_DBG_TRACE_EMIT(string, args...) no_printk(string, ##args)
+#define LKP_DBG_DUMP_STACK() dump_stack()
+#endif
+
+#ifdef __KLIB_LKP_H__
+static struct llkd_blog *lkp_dbg_blog __attribute__((unused));
+/* true if logged to the blog */
+#define LKP_DBG_BLOG_EMIT(string, args...)                              \
+	(lkp_dbg_blog ? (llkd_blog_printf(lkp_dbg_blog, string, ##args), 1) : 0)
+#else
+#define LKP_DBG_BLOG_EMIT(string, args...) 0
+#endif
+
+/* Emit via the currently selected backend */
+#define LKP_DBG_EMIT(string, args...) do {                              \
+	switch (READ_ONCE(lkp_dbg_backend)) {                               \
+	case LKP_DBG_TRACE:                                                 \
+		LKP_DBG_TRACE_EMIT(string, ##args);                             \
+		break;                                                          \
+	case LKP_DBG_PRINTK:                                                \
+		pr_info(string, ##args);                                        \
+		break;                                                          \
+	case LKP_DBG_BLOG:                                                  \
+		if (LKP_DBG_BLOG_EMIT(string, ##args))                          \
+			break;                                                      \
+		fallthrough;                                                    \
+	default:                                                            \
 		pr_info_ratelimited(string, ##args);                            \
 	}                                                                   \
-	else                                                                \
-		pr_info(string, ##args);                                        \
+} while (0)
+
+/* Run @stmt only if the (per call site) dynamic debug key's enabled */
+#if defined(CONFIG_DYNAMIC_DEBUG) || \
+	(defined(CONFIG_DYNAMIC_DEBUG_CORE) && defined(DYNAMIC_DEBUG_MODULE))
+#define LKP_DBG_SITE(string, stmt) do {                                 \
+	DEFINE_DYNAMIC_DEBUG_METADATA(lkp_dbg_site, string);                \
+	if (DYNAMIC_DEBUG_BRANCH(lkp_dbg_site)) {                           \
+		stmt;                                                           \
+	}                                                                   \
+} while (0)
+#else
+#define LKP_DBG_SITE(string, stmt) do {                                 \
+	stmt;                                                               \
 } while (0)
 #endif
+
+#define DBGPRINT(string, args...)                                       \
+	LKP_DBG_SITE(string, LKP_DBG_EMIT(string, ##args))
 #endif				/* #ifdef __KERNEL__ */
 
 /*------------------------ MSG, QP ------------------------------------*/
@@ -92,17 +203,9 @@
 #define QP MSG("\n")
 
 #ifdef __KERNEL__
-#ifndef USE_FTRACE_BUFFER
-#define QPDS do {                                                       \
-	MSG("\n");                                                          \
-	dump_stack();                                                       \
-} while (0)
-#else
-#define QPDS do {                                                       \
-	MSG("\n");                                                          \
-	trace_dump_stack();                                                 \
-} while (0)
-#endif
+#define QPDS LKP_DBG_SITE("%s:%d : \n",                                 \
+	LKP_DBG_EMIT("%s:%d : \n", __func__, __LINE__);                     \
+	LKP_DBG_DUMP_STACK())
 #endif
 
 #ifdef __KERNEL__
@@ -204,6 +307,95 @@ if (!(expr)) {                                                           \
 } while (0)
 #endif
 
+/*------------------------ lkp_burn_*() -------------------------------
+ * A calibrated CPU burner: busy-work for a given amount of *CPU* time, so that
+ * demos, benchmarks and cgroup experiments get a deterministic, comparable
+ * load (a bare empty loop's duration depends on the CPU and on the compiler,
+ * which may well elide it altogether).
+ * lkp_burn_calibrate() measures how many iterations of our busy loop take a
+ * millisecond on this box: the best of several runs, i.e., the least disturbed
+ * one. In the kernel, we time the runs with preemption off; in userspace, with
+ * the thread CPU-time clock, so preemption doesn't skew things either way.
+ * lkp_burn_us() and lkp_burn_ns() then burn the given CPU time; they calibrate
+ * on first use, which takes a few tens of ms - so, in the kernel, better call
+ * lkp_burn_calibrate() upfront (from your init code, say) if you'll burn while
+ * holding a spinlock.
+ * (The calibration's per compilation unit; for a multi-file module, do call it
+ * in each file that burns.)
+ */
+#ifdef __KERNEL__
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/preempt.h>
+#define lkp_burn_now_ns()	ktime_get_ns()
+#define LKP_DIV64(a, b)		div64_u64((a), (b))
+#else
+#include <time.h>
+static inline unsigned long long lkp_burn_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#define LKP_DIV64(a, b)		((a) / (b))
+#endif
+
+static unsigned long long lkp_loops_per_ms __attribute__((unused));
+
+/* Burn @n iterations of our busy loop (an LCG step each) */
+static inline void lkp_burn_loops(unsigned long long n)
+{
+	unsigned long long x = n;
+
+	while (n--) {
+		x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+		asm volatile("" : "+r" (x));	/* don't let the compiler elide the loop */
+	}
+}
+
+static inline unsigned long long lkp_burn_calibrate(void)
+{
+	unsigned long long n = 10000, t1, t2, lpm, best = 0;
+	int i;
+
+	for (i = 0; i < 10; i++) {
+#ifdef __KERNEL__
+		preempt_disable();
+#endif
+		t1 = lkp_burn_now_ns();
+		lkp_burn_loops(n);
+		t2 = lkp_burn_now_ns();
+#ifdef __KERNEL__
+		preempt_enable();
+#endif
+		if (t2 - t1 < 1000000 && n < (1ULL << 32)) {	/* aim for >= 1 ms runs */
+			n *= 2;
+			i--;
+			continue;
+		}
+		lpm = LKP_DIV64(n * 1000000, t2 - t1);
+		if (lpm > best)
+			best = lpm;
+	}
+	lkp_loops_per_ms = best ? best : 1;
+	return lkp_loops_per_ms;
+}
+
+/* Burn @ns nanoseconds of CPU time */
+static inline void lkp_burn_ns(unsigned long long ns)
+{
+	if (!lkp_loops_per_ms)
+		lkp_burn_calibrate();
+	lkp_burn_loops(LKP_DIV64(ns * lkp_loops_per_ms, 1000000));
+}
+
+/* Burn @us microseconds of CPU time */
+static inline void lkp_burn_us(unsigned long us)
+{
+	lkp_burn_ns(us * 1000ULL);
+}
+
 /*------------------------ DELAY_LOOP --------------------------------*/
 static inline void beep(int what)
 {
@@ -218,26 +410,20 @@ static inline void beep(int what)
 
 /*
  * DELAY_LOOP macro
- * (Mostly) mindlessly loop, then print a char (via our beep() routine,
- * to emulate 'work' :-)
+ * Emulate 'work': print a char (via our beep() routine), then burn
+ * DELAY_LOOP_US of CPU; repeat.
  * @val        : ASCII value to print
  * @loop_count : times to loop around
  */
-#define DELAY_LOOP(val, loop_count)                                        \
-{                                                                          \
-	int c = 0, m;                                                          \
-	unsigned int for_index, inner_index, x;                                \
+#define DELAY_LOOP_US	100
+#define DELAY_LOOP(val, loop_count) do {                                   \
+	unsigned int for_index;                                                \
 																			\
-	for (for_index = 0; for_index < loop_count; for_index++) {             \
+	for (for_index = 0; for_index < (loop_count); for_index++) {           \
 		beep((val));                                                       \
-		c++;                                                               \
-		for (inner_index = 0; inner_index < HZ; inner_index++) {           \
-			for (m = 0; m < 50; m++);                                      \
-			x = inner_index / 2;                                           \
-		}                                                                  \
+		lkp_burn_us(DELAY_LOOP_US);                                        \
 	}                                                                      \
-	/*printf("c=%d\n",c);*/                                                \
-}
+} while (0)
 /*------------------------------------------------------------------------*/
 
 #ifdef __KERNEL__
@@ -270,6 +456,8 @@ void delay_sec(long val)
 /*
  * SHOW_DELTA() macro
  * Show the difference between the timestamps passed
+ * (To time a code path repeatedly - with percentiles, per CPU - see the
+ * LLKD_TIME_START/END() histograms in our klib_llkd instead.)
  * Parameters:
  *  @later, @earlier : nanosecond-accurate timestamps
  * Expect that @later > @earlier
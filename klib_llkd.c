@@ -183,3 +183,1257 @@ void show_sizeof(void)
 		sizeof(long), sizeof(long long), sizeof(void *),
 		sizeof(float), sizeof(double), sizeof(long double));
 }
+
+/*------------------- per-CPU object magazine layer ---------------------*/
+/*
+ * llkd_mag_create - create a per-CPU magazine front end over the (existing)
+ * slab cache @cachep. Each possible CPU gets two (empty) magazines.
+ * Returns the magazine cache on success, NULL on failure.
+ */
+struct llkd_mag_cache *llkd_mag_create(struct kmem_cache *cachep)
+{
+	struct llkd_mag_cache *mc;
+	struct llkd_mag_cpu *pc;
+	int cpu;
+
+	if (!cachep)
+		return NULL;
+	mc = kzalloc(sizeof(struct llkd_mag_cache), GFP_KERNEL);
+	if (!mc)
+		return NULL;
+	mc->cachep = cachep;
+	spin_lock_init(&mc->depot_lock);
+	INIT_LIST_HEAD(&mc->depot_full);
+	INIT_LIST_HEAD(&mc->depot_empty);
+
+	mc->pcpu = alloc_percpu(struct llkd_mag_cpu);
+	if (!mc->pcpu)
+		goto out_fail;
+	for_each_possible_cpu(cpu) {
+		pc = per_cpu_ptr(mc->pcpu, cpu);
+		pc->loaded = kzalloc(sizeof(struct llkd_magazine), GFP_KERNEL);
+		pc->prev = kzalloc(sizeof(struct llkd_magazine), GFP_KERNEL);
+		if (!pc->loaded || !pc->prev)
+			goto out_fail;
+	}
+	return mc;
+
+out_fail:
+	llkd_mag_destroy(mc);
+	return NULL;
+}
+
+/* Return all objects held by magazine @m to the slab layer, then free @m */
+static void llkd_mag_drain(struct llkd_mag_cache *mc, struct llkd_magazine *m)
+{
+	if (!m)
+		return;
+	while (m->rounds)
+		kmem_cache_free(mc->cachep, m->objs[--m->rounds]);
+	kfree(m);
+}
+
+/*
+ * llkd_mag_destroy - return every cached object to the underlying slab cache
+ * and free the magazine layer. The slab cache itself is left alone (it's the
+ * caller's). The caller must ensure there are no concurrent users.
+ */
+void llkd_mag_destroy(struct llkd_mag_cache *mc)
+{
+	struct llkd_magazine *m, *tmp;
+	struct llkd_mag_cpu *pc;
+	int cpu;
+
+	if (!mc)
+		return;
+	if (mc->pcpu) {
+		for_each_possible_cpu(cpu) {
+			pc = per_cpu_ptr(mc->pcpu, cpu);
+			llkd_mag_drain(mc, pc->loaded);
+			llkd_mag_drain(mc, pc->prev);
+		}
+		free_percpu(mc->pcpu);
+	}
+	list_for_each_entry_safe(m, tmp, &mc->depot_full, list) {
+		list_del(&m->list);
+		llkd_mag_drain(mc, m);
+	}
+	list_for_each_entry_safe(m, tmp, &mc->depot_empty, list) {
+		list_del(&m->list);
+		kfree(m);
+	}
+	kfree(mc);
+}
+
+/*
+ * llkd_mag_alloc - allocate an object; served from this CPU's magazines when
+ * possible, else from a full magazine in the depot, else from the slab layer
+ * (with @flags).
+ */
+void *llkd_mag_alloc(struct llkd_mag_cache *mc, gfp_t flags)
+{
+	struct llkd_magazine *m;
+	struct llkd_mag_cpu *pc;
+	unsigned long irqflags;
+	void *obj = NULL;
+
+	local_irq_save(irqflags);
+	pc = this_cpu_ptr(mc->pcpu);
+	if (likely(pc->loaded->rounds))
+		goto pop;
+	if (pc->prev->rounds) {
+		swap(pc->loaded, pc->prev);
+		goto pop;
+	}
+	/* Both empty: exchange the (empty) prev for a full one from the depot */
+	spin_lock(&mc->depot_lock);
+	m = list_first_entry_or_null(&mc->depot_full, struct llkd_magazine, list);
+	if (m) {
+		list_del(&m->list);
+		mc->ndepot_full--;
+		list_add(&pc->prev->list, &mc->depot_empty);
+		mc->ndepot_empty++;
+		pc->prev = pc->loaded;
+		pc->loaded = m;
+	}
+	spin_unlock(&mc->depot_lock);
+	if (!m) {
+		pc->alloc_slab++;
+		local_irq_restore(irqflags);
+		return kmem_cache_alloc(mc->cachep, flags);
+	}
+pop:
+	obj = pc->loaded->objs[--pc->loaded->rounds];
+	pc->alloc_hits++;
+	local_irq_restore(irqflags);
+	return obj;
+}
+
+/*
+ * llkd_mag_free - free an object; it's cached in this CPU's magazines when
+ * possible, else a full magazine is exchanged at the depot for an empty one;
+ * if the depot is full too, the object is returned to the slab layer.
+ */
+void llkd_mag_free(struct llkd_mag_cache *mc, void *obj)
+{
+	struct llkd_magazine *m;
+	struct llkd_mag_cpu *pc;
+	unsigned long irqflags;
+
+	if (!obj)
+		return;
+	local_irq_save(irqflags);
+	pc = this_cpu_ptr(mc->pcpu);
+	if (likely(pc->loaded->rounds < LLKD_MAG_SIZE))
+		goto push;
+	if (pc->prev->rounds < LLKD_MAG_SIZE) {
+		swap(pc->loaded, pc->prev);
+		goto push;
+	}
+	/* Both full: exchange the (full) prev for an empty one from the depot */
+	spin_lock(&mc->depot_lock);
+	m = NULL;
+	if (mc->ndepot_full < LLKD_MAG_DEPOT_MAX) {
+		m = list_first_entry_or_null(&mc->depot_empty, struct llkd_magazine, list);
+		if (m) {
+			list_del(&m->list);
+			mc->ndepot_empty--;
+		} else		/* grow the depot */
+			m = kzalloc(sizeof(struct llkd_magazine), GFP_ATOMIC | __GFP_NOWARN);
+		if (m) {
+			list_add(&pc->prev->list, &mc->depot_full);
+			mc->ndepot_full++;
+			pc->prev = pc->loaded;
+			pc->loaded = m;
+		}
+	}
+	spin_unlock(&mc->depot_lock);
+	if (!m) {
+		pc->free_slab++;
+		local_irq_restore(irqflags);
+		kmem_cache_free(mc->cachep, obj);
+		return;
+	}
+push:
+	pc->loaded->objs[pc->loaded->rounds++] = obj;
+	pc->free_hits++;
+	local_irq_restore(irqflags);
+}
+
+/* llkd_mag_show_stats - show the per-CPU hit rates and the depot's state */
+void llkd_mag_show_stats(struct llkd_mag_cache *mc)
+{
+	struct llkd_mag_cpu *pc;
+	int cpu;
+
+	pr_info("magazine stats (size %d): depot has %u full, %u empty magazines\n",
+		LLKD_MAG_SIZE, mc->ndepot_full, mc->ndepot_empty);
+	pr_info(" cpu : alloc hits  from slab :  free hits    to slab\n");
+	for_each_online_cpu(cpu) {
+		pc = per_cpu_ptr(mc->pcpu, cpu);
+		if (!pc->alloc_hits && !pc->alloc_slab && !pc->free_hits && !pc->free_slab)
+			continue;
+		pr_info(" %3d : %10lu %10lu : %10lu %10lu\n", cpu,
+			pc->alloc_hits, pc->alloc_slab, pc->free_hits, pc->free_slab);
+	}
+}
+
+/*------------------- sampled use-after-free guard -----------------------*/
+
+/*
+ * flush_tlb_kernel_range() isn't exported to modules. WARNING! This is
+ * considered a hack (as in ch8/slab3_maxsize): we look up it's address via
+ * kallsyms_lookup_name(), which - as it too isn't exported on 5.7 and later
+ * kernels - we first locate via a kprobe.
+ */
+static void (*ptr_flush_tlb_kernel_range)(unsigned long start, unsigned long end);
+
+static unsigned long llkd_lookup_name(const char *name)
+{
+#ifdef CONFIG_KPROBES
+	struct kprobe kp = { .symbol_name = "kallsyms_lookup_name" };
+	unsigned long (*ptr_kallsyms_lookup_name)(const char *name);
+
+	if (register_kprobe(&kp) < 0)
+		return 0;
+	ptr_kallsyms_lookup_name = (void *)kp.addr;
+	unregister_kprobe(&kp);
+	if (!ptr_kallsyms_lookup_name)
+		return 0;
+	return ptr_kallsyms_lookup_name(name);
+#else
+	return 0;
+#endif
+}
+
+/*
+ * llkd_guard_create - wrap the slab cache @cachep (whose objects are
+ * initialized by @ctor, if non-NULL) with a sampling UAF guard: one in
+ * @sample_rate allocations is guarded, and up to @quar_depth freed ones are
+ * kept quarantined (unmapped). A @sample_rate of 0 disables sampling.
+ * Objects larger than a page are never sampled, nor is anything if we can't
+ * locate flush_tlb_kernel_range().
+ */
+struct llkd_guard_cache *llkd_guard_create(struct kmem_cache *cachep, void (*ctor)(void *),
+					   unsigned int sample_rate, unsigned int quar_depth)
+{
+	struct llkd_guard_cache *gc;
+
+	if (!cachep)
+		return NULL;
+	gc = kzalloc(sizeof(struct llkd_guard_cache), GFP_KERNEL);
+	if (!gc)
+		return NULL;
+	gc->count = alloc_percpu(unsigned int);
+	if (!gc->count) {
+		kfree(gc);
+		return NULL;
+	}
+	gc->cachep = cachep;
+	gc->ctor = ctor;
+	gc->objsz = kmem_cache_size(cachep);
+	gc->sample_rate = gc->objsz <= PAGE_SIZE ? sample_rate : 0;
+	if (gc->sample_rate && !ptr_flush_tlb_kernel_range) {
+		ptr_flush_tlb_kernel_range = (void *)llkd_lookup_name("flush_tlb_kernel_range");
+		if (!ptr_flush_tlb_kernel_range) {
+			pr_warn("%s(): couldn't locate flush_tlb_kernel_range(); not sampling\n",
+				__func__);
+			gc->sample_rate = 0;
+		}
+	}
+	gc->quar_depth = clamp_t(unsigned int, quar_depth, 1, LLKD_GUARD_MAX_QUAR);
+	spin_lock_init(&gc->lock);
+	return gc;
+}
+
+static int llkd_guard_unmap_pte(pte_t *pte, unsigned long addr, void *data)
+{
+	pte_clear(&init_mm, addr, pte);
+	return 0;
+}
+
+/*
+ * Unmap the page of the (vmalloc'ed) sampled object @obj, so that any further
+ * access to it faults. The page itself is only freed - by vfree() - when the
+ * object leaves the quarantine.
+ */
+static void llkd_guard_unmap(void *obj)
+{
+	unsigned long addr = (unsigned long)obj & PAGE_MASK;
+
+	if (apply_to_page_range(&init_mm, addr, PAGE_SIZE, llkd_guard_unmap_pte, NULL))
+		pr_warn("%s(): couldn't unmap guarded page 0x%lx\n", __func__, addr);
+	ptr_flush_tlb_kernel_range(addr, addr + PAGE_SIZE);
+}
+
+static inline void *llkd_guard_base(void *obj)
+{
+	return (void *)((unsigned long)obj & PAGE_MASK);
+}
+
+static void *llkd_guard_alloc_sampled(struct llkd_guard_cache *gc)
+{
+	void *page, *obj = NULL;
+	int i;
+
+	page = vzalloc(PAGE_SIZE);
+	if (!page)
+		return NULL;
+	/* right-align the object (keeping it long-aligned) against the guard page */
+	obj = page + ((PAGE_SIZE - gc->objsz) & ~(sizeof(long) - 1));
+
+	spin_lock(&gc->lock);
+	for (i = 0; i < LLKD_GUARD_MAX_LIVE; i++) {
+		if (!gc->live[i]) {
+			gc->live[i] = obj;
+			gc->nsampled++;
+			break;
+		}
+	}
+	if (i == LLKD_GUARD_MAX_LIVE) {	/* too many live ones; don't sample this time */
+		gc->nskipped++;
+		obj = NULL;
+	}
+	spin_unlock(&gc->lock);
+	if (!obj) {
+		vfree(page);
+		return NULL;
+	}
+	if (gc->ctor)
+		gc->ctor(obj);
+	return obj;
+}
+
+/*
+ * llkd_guard_alloc - allocate an object; every sample_rate'th one (per CPU)
+ * is a guarded one, provided @flags allow sleeping, else it's a regular slab
+ * allocation.
+ */
+void *llkd_guard_alloc(struct llkd_guard_cache *gc, gfp_t flags)
+{
+	void *obj;
+
+	if (gc->sample_rate && gfpflags_allow_blocking(flags) &&
+	    !(this_cpu_inc_return(*gc->count) % gc->sample_rate)) {
+		obj = llkd_guard_alloc_sampled(gc);
+		if (obj)
+			return obj;
+	}
+	return kmem_cache_alloc(gc->cachep, flags);
+}
+
+/*
+ * llkd_guard_free - free @obj; sampled (vmalloc'ed) objects are unmapped and
+ * quarantined, the oldest quarantined one being released when the quarantine
+ * is full. Regular objects go straight back to the slab cache.
+ * Process context only: the unmap (a cross-CPU TLB flush) and vfree() may
+ * sleep, and gc->lock isn't IRQ-safe.
+ */
+void llkd_guard_free(struct llkd_guard_cache *gc, void *obj)
+{
+	void *evict = NULL;
+	int i;
+
+	might_sleep();
+	if (!obj)
+		return;
+	if (!is_vmalloc_addr(obj)) {
+		kmem_cache_free(gc->cachep, obj);
+		return;
+	}
+
+	spin_lock(&gc->lock);
+	for (i = 0; i < LLKD_GUARD_MAX_LIVE; i++)
+		if (gc->live[i] == obj)
+			break;
+	if (i == LLKD_GUARD_MAX_LIVE) {
+		gc->ndoublefree++;
+		spin_unlock(&gc->lock);
+		pr_err("%s(): *** double (or invalid) free of sampled object 0x%px ***\n",
+		       __func__, obj);
+		WARN_ON_ONCE(1);
+		return;
+	}
+	gc->live[i] = NULL;
+	if (gc->nquar == gc->quar_depth) {
+		evict = gc->quar[gc->quar_head];
+		gc->nquar--;
+	}
+	gc->quar[gc->quar_head] = obj;
+	gc->quar_head = (gc->quar_head + 1) % gc->quar_depth;
+	gc->nquar++;
+	spin_unlock(&gc->lock);
+
+	llkd_guard_unmap(obj);
+	if (evict)
+		vfree(llkd_guard_base(evict));
+}
+
+/*
+ * llkd_guard_destroy - release the quarantine (and, reporting them as leaks,
+ * any still live sampled objects) and the guard itself; the slab cache is the
+ * caller's. The caller must ensure there are no concurrent users.
+ */
+void llkd_guard_destroy(struct llkd_guard_cache *gc)
+{
+	unsigned int i;
+
+	if (!gc)
+		return;
+	for (i = 0; i < LLKD_GUARD_MAX_LIVE; i++) {
+		if (!gc->live[i])
+			continue;
+		pr_warn("%s(): sampled object 0x%px leaked (never freed)\n", __func__, gc->live[i]);
+		vfree(llkd_guard_base(gc->live[i]));
+	}
+	for (i = 0; i < gc->nquar; i++)
+		vfree(llkd_guard_base(gc->quar[(gc->quar_head + gc->quar_depth - gc->nquar + i)
+					       % gc->quar_depth]));
+	free_percpu(gc->count);
+	kfree(gc);
+}
+
+/* llkd_guard_show_stats - show how many objects were sampled, quarantined, ... */
+void llkd_guard_show_stats(struct llkd_guard_cache *gc)
+{
+	pr_info("UAF guard (1 in %u sampled, objsz %zu): %lu sampled, %lu skipped (too many live),"
+		" %u quarantined, %lu double/invalid frees\n",
+		gc->sample_rate, gc->objsz, gc->nsampled, gc->nskipped, gc->nquar,
+		gc->ndoublefree);
+}
+
+/*------------------- object lifetime / leak tracker ---------------------*/
+static int llkd_track_show(struct seq_file *m, void *v);
+DEFINE_SHOW_ATTRIBUTE(llkd_track);
+
+/*
+ * llkd_track_create - set up a tracker, with it's debugfs report at
+ * /sys/kernel/debug/@name/outstanding (@name must stay valid for it's
+ * lifetime). Returns NULL on failure; as the wrappers treat a NULL tracker as
+ * 'tracking off', the caller can simply carry on untracked.
+ */
+struct llkd_track *llkd_track_create(const char *name)
+{
+	struct llkd_track *t;
+	int cpu, i;
+
+	t = kzalloc(sizeof(struct llkd_track), GFP_KERNEL);
+	if (!t)
+		return NULL;
+	t->name = name;
+	t->pcpu = alloc_percpu(struct llkd_track_cpu);
+	if (!t->pcpu)
+		goto out_free;
+	for_each_possible_cpu(cpu) {
+		struct llkd_track_cpu *tc = per_cpu_ptr(t->pcpu, cpu);
+
+		spin_lock_init(&tc->lock);
+		for (i = 0; i < ARRAY_SIZE(tc->hash); i++)
+			INIT_HLIST_HEAD(&tc->hash[i]);
+		INIT_HLIST_HEAD(&tc->spare);
+		tc->nspare = 0;
+	}
+	t->rec_cachep = kmem_cache_create("llkd_track_rec", sizeof(struct llkd_track_rec),
+					  0, 0, NULL);
+	if (!t->rec_cachep)
+		goto out_pcpu;
+
+	t->dbgdir = debugfs_create_dir(name, NULL);
+	if (IS_ERR_OR_NULL(t->dbgdir))
+		pr_warn("%s(): debugfs_create_dir(%s) failed; no debugfs report\n", __func__, name);
+	else
+		debugfs_create_file("outstanding", 0444, t->dbgdir, t, &llkd_track_fops);
+	return t;
+
+out_pcpu:
+	free_percpu(t->pcpu);
+out_free:
+	kfree(t);
+	return NULL;
+}
+
+static inline struct hlist_head *llkd_track_bucket(struct llkd_track_cpu *tc, const void *obj)
+{
+	return &tc->hash[hash_ptr((void *)obj, LLKD_TRACK_HASH_BITS)];
+}
+
+static void llkd_track_add(struct llkd_track *t, const void *obj, size_t size,
+			   unsigned long site, gfp_t flags)
+{
+	struct llkd_track_rec *rec = NULL;
+	struct llkd_track_cpu *tc;
+	unsigned long irqflags;
+	u64 ts = ktime_get_ns();
+
+	atomic_long_inc(&t->nalloc);
+	/* (being preempted and migrated here is harmless: free searches all CPUs) */
+	tc = raw_cpu_ptr(t->pcpu);
+	spin_lock_irqsave(&tc->lock, irqflags);
+	if (tc->nspare) {
+		rec = hlist_entry(tc->spare.first, struct llkd_track_rec, node);
+		hlist_del(&rec->node);
+		tc->nspare--;
+	}
+	spin_unlock_irqrestore(&tc->lock, irqflags);
+	if (!rec) {
+		rec = kmem_cache_alloc(t->rec_cachep, flags & ~__GFP_ZERO);
+		if (!rec) {
+			atomic_long_inc(&t->nuntracked);
+			return;
+		}
+	}
+	rec->obj = obj;
+	rec->site = site;
+	rec->size = size;
+	rec->ts = ts;
+
+	spin_lock_irqsave(&tc->lock, irqflags);
+	hlist_add_head(&rec->node, llkd_track_bucket(tc, obj));
+	spin_unlock_irqrestore(&tc->lock, irqflags);
+}
+
+/*
+ * Look up - and unlink - @obj's record in CPU @cpu's table, recycling it onto
+ * that CPU's spare list if there's room (else freeing it). Returns true if
+ * found.
+ */
+static bool llkd_track_unlink(struct llkd_track *t, int cpu, const void *obj)
+{
+	struct llkd_track_cpu *tc = per_cpu_ptr(t->pcpu, cpu);
+	struct llkd_track_rec *rec;
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&tc->lock, irqflags);
+	hlist_for_each_entry(rec, llkd_track_bucket(tc, obj), node) {
+		if (rec->obj != obj)
+			continue;
+		hlist_del(&rec->node);
+		if (tc->nspare < LLKD_TRACK_FREE_MAX) {
+			hlist_add_head(&rec->node, &tc->spare);
+			tc->nspare++;
+			rec = NULL;
+		}
+		spin_unlock_irqrestore(&tc->lock, irqflags);
+		if (rec)
+			kmem_cache_free(t->rec_cachep, rec);
+		return true;
+	}
+	spin_unlock_irqrestore(&tc->lock, irqflags);
+	return false;
+}
+
+static void llkd_track_del(struct llkd_track *t, const void *obj)
+{
+	int this_cpu = raw_smp_processor_id(), cpu;
+
+	atomic_long_inc(&t->nfree);
+	/* usually freed on the CPU it was allocated on; else, search the rest */
+	if (llkd_track_unlink(t, this_cpu, obj))
+		return;
+	for_each_possible_cpu(cpu) {
+		if (cpu != this_cpu && llkd_track_unlink(t, cpu, obj))
+			return;
+	}
+	/* its record alloc failed, or it wasn't allocated via us */
+	atomic_long_inc(&t->nunknown);
+}
+
+/*
+ * The allocation wrappers record their caller as the allocation site, so they
+ * mustn't be inlined into anything (they can't be across files anyway, unless
+ * built with LTO).
+ */
+noinline void *llkd_track_kmalloc(struct llkd_track *t, size_t size, gfp_t flags)
+{
+	void *obj = kmalloc(size, flags);
+
+	if (t && obj)
+		llkd_track_add(t, obj, size, _RET_IP_, flags);
+	return obj;
+}
+
+void llkd_track_kfree(struct llkd_track *t, const void *obj)
+{
+	if (t && !ZERO_OR_NULL_PTR(obj))
+		llkd_track_del(t, obj);
+	kfree(obj);
+}
+
+noinline void *llkd_track_cache_alloc(struct llkd_track *t, struct kmem_cache *cachep,
+				      gfp_t flags)
+{
+	void *obj = kmem_cache_alloc(cachep, flags);
+
+	if (t && obj)
+		llkd_track_add(t, obj, kmem_cache_size(cachep), _RET_IP_, flags);
+	return obj;
+}
+
+void llkd_track_cache_free(struct llkd_track *t, struct kmem_cache *cachep, void *obj)
+{
+	if (t && obj)
+		llkd_track_del(t, obj);
+	kmem_cache_free(cachep, obj);
+}
+
+/*------ reporting ------*/
+struct llkd_track_site {
+	unsigned long site;
+	unsigned long count;
+	size_t bytes;
+	u64 oldest_ts;
+};
+
+static int llkd_track_site_cmp(const void *a, const void *b)
+{
+	const struct llkd_track_site *x = a, *y = b;
+
+	return (x->count < y->count) - (x->count > y->count);	/* descending */
+}
+
+/*
+ * Aggregate all outstanding records, by call site, into @sites (an array of
+ * LLKD_TRACK_MAX_SITES); records from any further sites are only counted, in
+ * *@others. Returns the # of sites filled in, most outstanding objects first.
+ */
+static int llkd_track_collect(struct llkd_track *t, struct llkd_track_site *sites,
+			      unsigned long *others)
+{
+	struct llkd_track_rec *rec;
+	unsigned long irqflags;
+	int cpu, b, i, nsites = 0;
+
+	*others = 0;
+	for_each_possible_cpu(cpu) {
+		struct llkd_track_cpu *tc = per_cpu_ptr(t->pcpu, cpu);
+
+		spin_lock_irqsave(&tc->lock, irqflags);
+		for (b = 0; b < ARRAY_SIZE(tc->hash); b++) {
+			hlist_for_each_entry(rec, &tc->hash[b], node) {
+				for (i = 0; i < nsites; i++)
+					if (sites[i].site == rec->site)
+						break;
+				if (i == nsites) {
+					if (nsites == LLKD_TRACK_MAX_SITES) {
+						(*others)++;
+						continue;
+					}
+					sites[i].site = rec->site;
+					sites[i].oldest_ts = rec->ts;
+					nsites++;
+				}
+				sites[i].count++;
+				sites[i].bytes += rec->size;
+				if (rec->ts < sites[i].oldest_ts)
+					sites[i].oldest_ts = rec->ts;
+			}
+		}
+		spin_unlock_irqrestore(&tc->lock, irqflags);
+	}
+	sort(sites, nsites, sizeof(struct llkd_track_site), llkd_track_site_cmp, NULL);
+	return nsites;
+}
+
+/* Emit the report to the seq_file @m, or, if it's NULL, to the kernel log */
+#define llkd_track_out(m, fmt, ...) do {		\
+	if (m)						\
+		seq_printf(m, fmt, ##__VA_ARGS__);	\
+	else						\
+		pr_info(fmt, ##__VA_ARGS__);		\
+} while (0)
+
+static void llkd_track_report(struct llkd_track *t, struct seq_file *m)
+{
+	struct llkd_track_site *sites;
+	unsigned long others, total = 0;
+	u64 now = ktime_get_ns();
+	int i, nsites;
+
+	sites = kcalloc(LLKD_TRACK_MAX_SITES, sizeof(struct llkd_track_site), GFP_KERNEL);
+	if (!sites)
+		return;
+	nsites = llkd_track_collect(t, sites, &others);
+
+	llkd_track_out(m, "%s: %ld allocs, %ld frees (%ld untracked allocs, %ld unknown frees)\n",
+		       t->name, atomic_long_read(&t->nalloc), atomic_long_read(&t->nfree),
+		       atomic_long_read(&t->nuntracked), atomic_long_read(&t->nunknown));
+	if (nsites)
+		llkd_track_out(m, "   objects        bytes  oldest(ms)  allocation site\n");
+	for (i = 0; i < nsites; i++) {
+		llkd_track_out(m, " %9lu %12zu %11llu  %pS\n", sites[i].count, sites[i].bytes,
+			       div_u64(now - sites[i].oldest_ts, NSEC_PER_MSEC),
+			       (void *)sites[i].site);
+		total += sites[i].count;
+	}
+	if (others)
+		llkd_track_out(m, " %9lu  (from further call sites)\n", others);
+	llkd_track_out(m, "%s: %lu objects outstanding\n", t->name, total + others);
+	kfree(sites);
+}
+
+static int llkd_track_show(struct seq_file *m, void *v)
+{
+	llkd_track_report(m->private, m);
+	return 0;
+}
+
+/*
+ * llkd_track_destroy - remove the debugfs report and log the final one: all
+ * objects still outstanding at this point (module unload) were leaked. Their
+ * records are released; the objects themselves, of course, aren't.
+ */
+void llkd_track_destroy(struct llkd_track *t)
+{
+	struct llkd_track_rec *rec;
+	struct hlist_node *tmp;
+	int cpu, b;
+
+	if (!t)
+		return;
+	debugfs_remove_recursive(t->dbgdir);
+	llkd_track_report(t, NULL);
+
+	for_each_possible_cpu(cpu) {
+		struct llkd_track_cpu *tc = per_cpu_ptr(t->pcpu, cpu);
+
+		for (b = 0; b < ARRAY_SIZE(tc->hash); b++) {
+			hlist_for_each_entry_safe(rec, tmp, &tc->hash[b], node) {
+				hlist_del(&rec->node);
+				kmem_cache_free(t->rec_cachep, rec);
+			}
+		}
+		hlist_for_each_entry_safe(rec, tmp, &tc->spare, node) {
+			hlist_del(&rec->node);
+			kmem_cache_free(t->rec_cachep, rec);
+		}
+	}
+	kmem_cache_destroy(t->rec_cachep);
+	free_percpu(t->pcpu);
+	kfree(t);
+}
+
+/*------------------- per-CPU binary log ('blog') ------------------------*/
+/*
+ * A ring holds variable length records, each 8-byte aligned, starting with
+ * this header; one that doesn't fit before the ring's end is preceded by a
+ * padding record (fmt NULL) - or, if even the header wouldn't fit, by nothing:
+ * both writer and readers then simply skip to the ring's start.
+ */
+struct llkd_blog_hdr {
+	u64 ts;			/* ktime_get_ns() */
+	const char *fmt;	/* NULL: padding, up to the ring's end */
+	u32 len;		/* of the whole record, header included */
+	u32 flags;
+};
+#define LLKD_BLOG_HDR_SZ	ALIGN(sizeof(struct llkd_blog_hdr), 8)
+#define LLKD_BLOG_FORMATTED	0x1	/* the payload's the formatted message */
+#define LLKD_BLOG_LINE_MAX	512	/* max formatted message length, on read */
+
+/* A reader's position in one CPU's ring, and the record it's holding */
+struct llkd_blog_cur {
+	u64 pos, head;
+	bool valid;
+	struct llkd_blog_hdr h;
+	u32 payload[LLKD_BLOG_MAX_ARGS / sizeof(u32)];
+};
+
+static int llkd_blog_log_show(struct seq_file *m, void *v);
+DEFINE_SHOW_ATTRIBUTE(llkd_blog_log);
+static int llkd_blog_stats_show(struct seq_file *m, void *v);
+DEFINE_SHOW_ATTRIBUTE(llkd_blog_stats);
+
+static ssize_t llkd_blog_clear_write(struct file *filp, const char __user *ubuf,
+				     size_t count, loff_t *off)
+{
+	struct llkd_blog *b = filp->private_data;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct llkd_blog_cpu *bc = per_cpu_ptr(b->pcpu, cpu);
+
+		WRITE_ONCE(bc->floor, smp_load_acquire(&bc->head));
+	}
+	return count;
+}
+
+static const struct file_operations llkd_blog_clear_fops = {
+	.open = simple_open,
+	.write = llkd_blog_clear_write,
+};
+
+/*
+ * llkd_blog_create - set up a per-CPU binary log of @size bytes per CPU (0
+ * for the default; rounded up to a power of 2), readable at
+ * /sys/kernel/debug/@name/ (@name must stay valid for it's lifetime).
+ * Returns NULL on failure; llkd_blog_printf() on a NULL log does nothing.
+ */
+struct llkd_blog *llkd_blog_create(const char *name, unsigned int size)
+{
+	struct llkd_blog *b;
+	int cpu;
+
+	b = kzalloc(sizeof(struct llkd_blog), GFP_KERNEL);
+	if (!b)
+		return NULL;
+	b->name = name;
+	b->size = roundup_pow_of_two(max_t(unsigned int, size ? size : LLKD_BLOG_DEF_SIZE,
+					   PAGE_SIZE));
+	b->pcpu = alloc_percpu(struct llkd_blog_cpu);
+	if (!b->pcpu)
+		goto out_free;
+	for_each_possible_cpu(cpu) {
+		struct llkd_blog_cpu *bc = per_cpu_ptr(b->pcpu, cpu);
+
+		bc->buf = vzalloc_node(b->size, cpu_to_node(cpu));
+		if (!bc->buf)
+			goto out_bufs;
+	}
+
+	b->dbgdir = debugfs_create_dir(name, NULL);
+	if (IS_ERR_OR_NULL(b->dbgdir)) {
+		pr_warn("%s(): debugfs_create_dir(%s) failed; the log can't be read\n",
+			__func__, name);
+	} else {
+		debugfs_create_file("log", 0444, b->dbgdir, b, &llkd_blog_log_fops);
+		debugfs_create_file("stats", 0444, b->dbgdir, b, &llkd_blog_stats_fops);
+		debugfs_create_file("clear", 0200, b->dbgdir, b, &llkd_blog_clear_fops);
+	}
+	return b;
+
+out_bufs:
+	for_each_possible_cpu(cpu)
+		vfree(per_cpu_ptr(b->pcpu, cpu)->buf);
+	free_percpu(b->pcpu);
+out_free:
+	kfree(b);
+	return NULL;
+}
+
+void llkd_blog_destroy(struct llkd_blog *b)
+{
+	int cpu;
+
+	if (!b)
+		return;
+	debugfs_remove_recursive(b->dbgdir);
+	for_each_possible_cpu(cpu)
+		vfree(per_cpu_ptr(b->pcpu, cpu)->buf);
+	free_percpu(b->pcpu);
+	kfree(b);
+}
+
+/*
+ * Writer side: advance @bc's tail past the oldest records until the ring can
+ * hold everything up to @end. Readers check the tail after copying a record
+ * out; so it must move *before* we overwrite anything it covered.
+ */
+static void llkd_blog_make_room(struct llkd_blog *b, struct llkd_blog_cpu *bc, u64 end)
+{
+	u32 mask = b->size - 1, off;
+	u64 tail = bc->tail;
+	struct llkd_blog_hdr *h;
+
+	while (end - tail > b->size) {
+		off = tail & mask;
+		if (b->size - off < LLKD_BLOG_HDR_SZ) {
+			tail += b->size - off;
+			continue;
+		}
+		h = (struct llkd_blog_hdr *)(bc->buf + off);
+		if (h->fmt)
+			bc->noverwritten++;
+		tail += h->len;
+	}
+	WRITE_ONCE(bc->tail, tail);
+	smp_wmb();
+}
+
+void llkd_blog_vprintf(struct llkd_blog *b, const char *fmt, va_list args)
+{
+	u32 payload[LLKD_BLOG_MAX_ARGS / sizeof(u32)];
+	u32 mask, off, len, flags = 0, pad = 0;
+	struct llkd_blog_cpu *bc;
+	struct llkd_blog_hdr *h;
+	unsigned long irqflags;
+	size_t n = 0;
+	u64 pos;
+#ifdef CONFIG_BINARY_PRINTF
+	va_list args2;
+#endif
+
+	if (!b)
+		return;
+	if (unlikely(in_nmi())) {
+		this_cpu_inc(b->pcpu->nnmi);
+		return;
+	}
+
+	/* Pack the args (or, failing that, format the message) locally first */
+#ifdef CONFIG_BINARY_PRINTF
+	va_copy(args2, args);
+	n = vbin_printf(payload, ARRAY_SIZE(payload), fmt, args2) * sizeof(u32);
+	va_end(args2);
+	if (n > sizeof(payload))	/* too much to pack; store it truncated, formatted */
+		n = 0;
+#endif
+	if (!n) {
+		n = vscnprintf((char *)payload, sizeof(payload), fmt, args) + 1;
+		flags = LLKD_BLOG_FORMATTED;
+	}
+	len = ALIGN(LLKD_BLOG_HDR_SZ + n, 8);
+	mask = b->size - 1;
+
+	local_irq_save(irqflags);
+	bc = this_cpu_ptr(b->pcpu);
+	pos = bc->head;
+	off = pos & mask;
+	if (b->size - off < len)	/* doesn't fit before the end: pad, wrap */
+		pad = b->size - off;
+	llkd_blog_make_room(b, bc, pos + pad + len);
+
+	if (pad) {
+		if (pad >= LLKD_BLOG_HDR_SZ) {
+			h = (struct llkd_blog_hdr *)(bc->buf + off);
+			h->fmt = NULL;
+			h->len = pad;
+		}
+		pos += pad;
+		off = 0;
+	}
+	h = (struct llkd_blog_hdr *)(bc->buf + off);
+	h->ts = ktime_get_ns();
+	h->fmt = fmt;
+	h->len = len;
+	h->flags = flags;
+	memcpy(bc->buf + off + LLKD_BLOG_HDR_SZ, payload, n);
+	smp_store_release(&bc->head, pos + len);
+	bc->nwritten++;
+	local_irq_restore(irqflags);
+}
+
+/*
+ * llkd_blog_printf - log a message to @b; the printf-style @fmt must outlive
+ * the log. Any context but NMI.
+ */
+void llkd_blog_printf(struct llkd_blog *b, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	llkd_blog_vprintf(b, fmt, args);
+	va_end(args);
+}
+
+/*
+ * Reader side: fetch (a copy of) the next record at or after @c->pos in
+ * @bc's ring, skipping padding and anything overwritten under us.
+ */
+static bool llkd_blog_fetch(struct llkd_blog *b, struct llkd_blog_cpu *bc,
+			    struct llkd_blog_cur *c)
+{
+	u32 mask = b->size - 1, off, len;
+
+	while (1) {
+		c->pos = max(c->pos, READ_ONCE(bc->tail));
+		smp_rmb();
+		if (c->pos >= c->head)
+			return false;
+		off = c->pos & mask;
+		if (b->size - off < LLKD_BLOG_HDR_SZ) {
+			c->pos += b->size - off;
+			continue;
+		}
+		memcpy(&c->h, bc->buf + off, sizeof(struct llkd_blog_hdr));
+		len = min_t(u32, c->h.len, LLKD_BLOG_HDR_SZ + LLKD_BLOG_MAX_ARGS);
+		if (c->h.fmt && len > LLKD_BLOG_HDR_SZ)
+			memcpy(c->payload, bc->buf + off + LLKD_BLOG_HDR_SZ,
+			       len - LLKD_BLOG_HDR_SZ);
+		smp_rmb();
+		if (READ_ONCE(bc->tail) > c->pos)	/* overwritten as we copied it */
+			continue;
+		if (WARN_ON_ONCE(c->h.len < LLKD_BLOG_HDR_SZ))
+			return false;
+		c->pos += c->h.len;
+		if (c->h.fmt)
+			return true;
+	}
+}
+
+/* Show all CPUs' records, merged in timestamp order */
+static int llkd_blog_log_show(struct seq_file *m, void *v)
+{
+	struct llkd_blog *b = m->private;
+	struct llkd_blog_cur *curs, *c;
+	struct llkd_blog_cpu *bc;
+	unsigned long usecs;
+	char *line;
+	int cpu, best;
+	u64 secs;
+	size_t n;
+
+	curs = kvcalloc(nr_cpu_ids, sizeof(struct llkd_blog_cur), GFP_KERNEL);
+	line = kmalloc(LLKD_BLOG_LINE_MAX, GFP_KERNEL);
+	if (!curs || !line) {
+		kvfree(curs);
+		kfree(line);
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu) {
+		bc = per_cpu_ptr(b->pcpu, cpu);
+		c = &curs[cpu];
+		c->head = smp_load_acquire(&bc->head);
+		c->pos = READ_ONCE(bc->floor);
+		c->valid = llkd_blog_fetch(b, bc, c);
+	}
+
+	while (1) {
+		best = -1;
+		for_each_possible_cpu(cpu) {
+			if (curs[cpu].valid && (best < 0 || curs[cpu].h.ts < curs[best].h.ts))
+				best = cpu;
+		}
+		if (best < 0)
+			break;
+		c = &curs[best];
+#ifdef CONFIG_BINARY_PRINTF
+		if (!(c->h.flags & LLKD_BLOG_FORMATTED))
+			bstr_printf(line, LLKD_BLOG_LINE_MAX, c->h.fmt, c->payload);
+		else
+#endif
+			strscpy(line, (char *)c->payload, sizeof(c->payload));
+		n = strlen(line);
+		secs = c->h.ts;
+		usecs = do_div(secs, NSEC_PER_SEC) / NSEC_PER_USEC;
+		seq_printf(m, "[%03d] %5llu.%06lu: %s%s", best, secs, usecs, line,
+			   (n && line[n - 1] == '\n') ? "" : "\n");
+		c->valid = llkd_blog_fetch(b, per_cpu_ptr(b->pcpu, best), c);
+	}
+	kfree(line);
+	kvfree(curs);
+	return 0;
+}
+
+static int llkd_blog_stats_show(struct seq_file *m, void *v)
+{
+	struct llkd_blog *b = m->private;
+	int cpu;
+
+	seq_printf(m, "%s: %u bytes per CPU\n%4s %12s %12s %10s %8s\n", b->name, b->size,
+		   "cpu", "written", "overwritten", "bytes", "nmi-drop");
+	for_each_possible_cpu(cpu) {
+		struct llkd_blog_cpu *bc = per_cpu_ptr(b->pcpu, cpu);
+
+		if (!bc->nwritten && !bc->nnmi)
+			continue;
+		seq_printf(m, "%4d %12lu %12lu %10llu %8lu\n", cpu, bc->nwritten,
+			   bc->noverwritten, bc->head - READ_ONCE(bc->tail), bc->nnmi);
+	}
+	return 0;
+}
+
+/*------------------- timing histograms ----------------------------------*/
+/* The lower bound (in ns) of bucket @idx; the inverse of llkd_hist_bucket() */
+static inline u64 llkd_hist_bucket_lo(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < 2 * LLKD_HIST_SUB)
+		return idx;
+	shift = idx / LLKD_HIST_SUB - 1;
+	return (u64)(idx - shift * LLKD_HIST_SUB) << shift;
+}
+
+/* The (bucket lower bound) value at percentile @pct_x100 / 100 of @hc */
+static u64 llkd_hist_percentile(const struct llkd_hist_cpu *hc, unsigned int pct_x100)
+{
+	u64 target = div_u64(hc->count * pct_x100 + 9999, 10000), cum = 0;
+	unsigned int i;
+
+	for (i = 0; i < LLKD_HIST_NBUCKETS; i++) {
+		cum += hc->hist[i];
+		if (cum >= target)
+			return llkd_hist_bucket_lo(i);
+	}
+	return llkd_hist_bucket_lo(LLKD_HIST_NBUCKETS - 1);
+}
+
+/* Merge all CPUs' histograms into @all */
+static void llkd_hist_merge(struct llkd_hist *h, struct llkd_hist_cpu *all)
+{
+	unsigned int i;
+	int cpu;
+
+	memset(all, 0, sizeof(struct llkd_hist_cpu));
+	all->min = U64_MAX;
+	for_each_possible_cpu(cpu) {
+		struct llkd_hist_cpu *hc = per_cpu_ptr(h->pcpu, cpu);
+
+		all->count += hc->count;
+		all->sum += hc->sum;
+		all->min = min(all->min, hc->min);
+		all->max = max(all->max, hc->max);
+		for (i = 0; i < LLKD_HIST_NBUCKETS; i++)
+			all->hist[i] += hc->hist[i];
+	}
+}
+
+/* Output to the seq_file @m if non-NULL, else to the kernel log */
+#define llkd_hist_out(m, fmt, ...) do {            \
+	if (m)                                     \
+		seq_printf(m, fmt, ##__VA_ARGS__); \
+	else                                       \
+		pr_info(fmt, ##__VA_ARGS__);       \
+} while (0)
+
+static void llkd_hist_line(struct seq_file *m, const char *who, const struct llkd_hist_cpu *hc)
+{
+	if (!hc->count) {
+		llkd_hist_out(m, "%-6s %12s\n", who, "-");
+		return;
+	}
+	llkd_hist_out(m, "%-6s %12llu %8llu %8llu %9llu %9llu %9llu %9llu %9llu %9llu\n", who,
+		      hc->count, hc->min, div64_u64(hc->sum, hc->count), hc->max,
+		      llkd_hist_percentile(hc, 5000), llkd_hist_percentile(hc, 9000),
+		      llkd_hist_percentile(hc, 9900), llkd_hist_percentile(hc, 9990),
+		      llkd_hist_percentile(hc, 9999));
+}
+
+#define LLKD_HIST_HDR_FMT "%-6s %12s %8s %8s %9s %9s %9s %9s %9s %9s\n"
+#define LLKD_HIST_HDR_ARGS "cpu", "samples", "min", "avg", "max", "p50", "p90", "p99", \
+	"p99.9", "p99.99"
+
+static int llkd_hist_summary_show(struct seq_file *m, void *v)
+{
+	struct llkd_hist *h = m->private;
+	struct llkd_hist_cpu *all;
+	char who[16];
+	int cpu;
+
+	all = kzalloc(sizeof(struct llkd_hist_cpu), GFP_KERNEL);
+	if (!all)
+		return -ENOMEM;
+	seq_printf(m, "%s (ns)\n" LLKD_HIST_HDR_FMT, h->name, LLKD_HIST_HDR_ARGS);
+	for_each_online_cpu(cpu) {
+		snprintf(who, sizeof(who), "%d", cpu);
+		llkd_hist_line(m, who, per_cpu_ptr(h->pcpu, cpu));
+	}
+	llkd_hist_merge(h, all);
+	llkd_hist_line(m, "all", all);
+	kfree(all);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(llkd_hist_summary);
+
+static int llkd_hist_histogram_show(struct seq_file *m, void *v)
+{
+	struct llkd_hist *h = m->private;
+	unsigned int i;
+	int cpu;
+	bool empty;
+
+	seq_puts(m, "# ns");
+	for_each_online_cpu(cpu)
+		seq_printf(m, "\tcpu%d", cpu);
+	seq_puts(m, "\n");
+
+	for (i = 0; i < LLKD_HIST_NBUCKETS; i++) {
+		empty = true;
+		for_each_online_cpu(cpu) {
+			if (per_cpu_ptr(h->pcpu, cpu)->hist[i]) {
+				empty = false;
+				break;
+			}
+		}
+		if (empty)
+			continue;
+		seq_printf(m, "%llu", llkd_hist_bucket_lo(i));
+		for_each_online_cpu(cpu)
+			seq_printf(m, "\t%llu", per_cpu_ptr(h->pcpu, cpu)->hist[i]);
+		seq_puts(m, "\n");
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(llkd_hist_histogram);
+
+static ssize_t llkd_hist_reset_write(struct file *filp, const char __user *ubuf,
+				     size_t count, loff_t *off)
+{
+	/* racy wrt the recorders, but any torn sample is simply lost */
+	llkd_hist_reset(filp->private_data);
+	return count;
+}
+
+static const struct file_operations llkd_hist_reset_fops = {
+	.open = simple_open,
+	.write = llkd_hist_reset_write,
+};
+
+/*
+ * llkd_hist_create - set up a (per-CPU) histogram @name, with it's debugfs
+ * files under /sys/kernel/debug/[@parent/]@name/ (@name must stay valid for
+ * it's lifetime). Returns NULL on failure; recording into a NULL histogram
+ * does nothing, so the caller can simply carry on.
+ */
+struct llkd_hist *llkd_hist_create(const char *name, struct dentry *parent)
+{
+	struct llkd_hist *h;
+
+	h = kzalloc(sizeof(struct llkd_hist), GFP_KERNEL);
+	if (!h)
+		return NULL;
+	h->name = name;
+	h->pcpu = alloc_percpu(struct llkd_hist_cpu);
+	if (!h->pcpu) {
+		kfree(h);
+		return NULL;
+	}
+	llkd_hist_reset(h);
+
+	h->dbgdir = debugfs_create_dir(name, parent);
+	if (IS_ERR_OR_NULL(h->dbgdir)) {
+		pr_warn("%s(): debugfs_create_dir(%s) failed; no debugfs report\n", __func__, name);
+	} else {
+		debugfs_create_file("summary", 0444, h->dbgdir, h, &llkd_hist_summary_fops);
+		debugfs_create_file("histogram", 0444, h->dbgdir, h, &llkd_hist_histogram_fops);
+		debugfs_create_file("reset", 0200, h->dbgdir, h, &llkd_hist_reset_fops);
+	}
+	return h;
+}
+
+void llkd_hist_destroy(struct llkd_hist *h)
+{
+	if (!h)
+		return;
+	debugfs_remove_recursive(h->dbgdir);
+	free_percpu(h->pcpu);
+	kfree(h);
+}
+
+void llkd_hist_reset(struct llkd_hist *h)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct llkd_hist_cpu *hc = per_cpu_ptr(h->pcpu, cpu);
+
+		memset(hc, 0, sizeof(struct llkd_hist_cpu));
+		hc->min = U64_MAX;
+	}
+}
+
+/* llkd_hist_log - log @h's merged (all CPUs) summary to the kernel log */
+void llkd_hist_log(struct llkd_hist *h)
+{
+	struct llkd_hist_cpu *all;
+
+	if (!h)
+		return;
+	all = kzalloc(sizeof(struct llkd_hist_cpu), GFP_KERNEL);
+	if (!all)
+		return;
+	llkd_hist_merge(h, all);
+	pr_info("%s (ns)\n", h->name);
+	llkd_hist_out(NULL, LLKD_HIST_HDR_FMT, LLKD_HIST_HDR_ARGS);
+	llkd_hist_line(NULL, "all", all);
+	kfree(all);
+}
@@ -22,10 +22,265 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <asm/io.h>		/* virt_to_phys(), phys_to_virt(), ... */
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/kprobes.h>	/* to locate kallsyms_lookup_name() */
+#include <linux/hash.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sort.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/sched/clock.h>	/* local_clock() */
 
 void llkd_minsysinfo(void);
 u64 powerof(int base, int exponent);
 void show_phy_pages(const void *kaddr, size_t len, bool contiguity_check);
 void show_sizeof(void);
 
+/*------------------- per-CPU object magazine layer ---------------------
+ * A per-CPU 'magazine' front end (a la Bonwick's Vmem/magazines paper) that
+ * sits over any kmem_cache. Each CPU holds two magazines (stacks of up to
+ * LLKD_MAG_SIZE free objects) - 'loaded' and 'prev'; allocs pop from and frees
+ * push onto the loaded one, swapping the two when it runs empty/full. Only when
+ * both can't serve the request do we go to the (spinlock protected) depot of
+ * full and empty magazines, and only when that can't either, to the slab layer.
+ */
+#define LLKD_MAG_SIZE        32
+#define LLKD_MAG_DEPOT_MAX   64	/* max # of full magazines the depot retains */
+
+struct llkd_magazine {
+	unsigned int rounds;	/* # of objects currently held */
+	struct list_head list;	/* on the depot's full or empty list */
+	void *objs[LLKD_MAG_SIZE];
+};
+
+struct llkd_mag_cpu {
+	struct llkd_magazine *loaded, *prev;
+	unsigned long alloc_hits, alloc_slab, free_hits, free_slab;
+};
+
+struct llkd_mag_cache {
+	struct kmem_cache *cachep;	/* the underlying slab cache */
+	struct llkd_mag_cpu __percpu *pcpu;
+	spinlock_t depot_lock;
+	struct list_head depot_full, depot_empty;
+	unsigned int ndepot_full, ndepot_empty;
+};
+
+struct llkd_mag_cache *llkd_mag_create(struct kmem_cache *cachep);
+void llkd_mag_destroy(struct llkd_mag_cache *mc);
+void *llkd_mag_alloc(struct llkd_mag_cache *mc, gfp_t flags);
+void llkd_mag_free(struct llkd_mag_cache *mc, void *obj);
+void llkd_mag_show_stats(struct llkd_mag_cache *mc);
+
+/*------------------- sampled use-after-free guard -----------------------
+ * A low overhead, sampling UAF detector (in the spirit of the kernel's KFENCE)
+ * wrapped around any kmem_cache: one in 'sample_rate' allocations is served
+ * not from the slab but from it's own vmalloc'ed page - right-aligned, so
+ * that overflows run into the vmalloc guard page beyond it. On free, the
+ * page is unmapped and the object quarantined (it's virtual address stays
+ * reserved); any later access to it thus faults - Oops-ing with the address
+ * and the offending call stack - instead of silently corrupting memory.
+ * Double frees of sampled objects are reported as well.
+ * Unmapping needs flush_tlb_kernel_range(), which isn't exported to modules;
+ * we look it up at runtime (CONFIG_KPROBES and CONFIG_KALLSYMS), and without
+ * it, don't sample. llkd_guard_free() may sleep: call it from process context
+ * only.
+ */
+#define LLKD_GUARD_MAX_LIVE     64	/* max # of live sampled objects */
+#define LLKD_GUARD_MAX_QUAR    256	/* max quarantine depth */
+
+struct llkd_guard_cache {
+	struct kmem_cache *cachep;	/* the underlying slab cache */
+	void (*ctor)(void *);		/* run on sampled objects */
+	size_t objsz;
+	unsigned int sample_rate, quar_depth;
+	unsigned int __percpu *count;
+	spinlock_t lock;		/* protects the below */
+	void *live[LLKD_GUARD_MAX_LIVE];	/* live sampled objects */
+	void *quar[LLKD_GUARD_MAX_QUAR];	/* ring of freed (unmapped) ones */
+	unsigned int quar_head, nquar;
+	unsigned long nsampled, nskipped, ndoublefree;
+};
+
+struct llkd_guard_cache *llkd_guard_create(struct kmem_cache *cachep, void (*ctor)(void *),
+					   unsigned int sample_rate, unsigned int quar_depth);
+void llkd_guard_destroy(struct llkd_guard_cache *gc);
+void *llkd_guard_alloc(struct llkd_guard_cache *gc, gfp_t flags);
+void llkd_guard_free(struct llkd_guard_cache *gc, void *obj);
+void llkd_guard_show_stats(struct llkd_guard_cache *gc);
+
+/*------------------- object lifetime / leak tracker ---------------------
+ * An opt-in tracker for a module's own slab allocations: allocate and free via
+ * the llkd_track_*() wrappers below and every live object is recorded - along
+ * with it's size, allocation call site and timestamp - in a per-CPU hash table
+ * (frees look up the local CPU's table first, so the common case never touches
+ * another CPU's lock or cachelines), and records are recycled via per-CPU
+ * spare lists, keeping the tracking overhead small. The outstanding objects, grouped by call
+ * site, can be read at any time via debugfs:
+ *   /sys/kernel/debug/<name>/outstanding
+ * and are reported to the kernel log on llkd_track_destroy(), typically from
+ * the module's cleanup: anything still listed then is a leak.
+ * Passing a NULL tracker makes the wrappers plain kmalloc() etc, so tracking
+ * can be a module parameter away.
+ */
+#define LLKD_TRACK_HASH_BITS   8
+#define LLKD_TRACK_MAX_SITES  32	/* distinct call sites we report on */
+#define LLKD_TRACK_FREE_MAX  256	/* max # of spare records cached per CPU */
+
+struct llkd_track_rec {
+	struct hlist_node node;
+	const void *obj;
+	unsigned long site;	/* allocation call site (return address) */
+	size_t size;
+	u64 ts;			/* allocation timestamp (ns) */
+};
+
+struct llkd_track_cpu {
+	spinlock_t lock;
+	struct hlist_head hash[1 << LLKD_TRACK_HASH_BITS];
+	struct hlist_head spare;	/* recycled records; saves a slab round trip */
+	unsigned int nspare;
+};
+
+struct llkd_track {
+	const char *name;
+	struct llkd_track_cpu __percpu *pcpu;
+	struct kmem_cache *rec_cachep;	/* for our llkd_track_rec's */
+	struct dentry *dbgdir;
+	atomic_long_t nalloc, nfree, nuntracked, nunknown;
+};
+
+struct llkd_track *llkd_track_create(const char *name);
+void llkd_track_destroy(struct llkd_track *t);
+void *llkd_track_kmalloc(struct llkd_track *t, size_t size, gfp_t flags);
+void llkd_track_kfree(struct llkd_track *t, const void *obj);
+void *llkd_track_cache_alloc(struct llkd_track *t, struct kmem_cache *cachep, gfp_t flags);
+void llkd_track_cache_free(struct llkd_track *t, struct kmem_cache *cachep, void *obj);
+
+
+/*------------------- per-CPU binary log ('blog') ------------------------
+ * A fast logging backend for code that logs at high rates, where even a
+ * rate-limited printk() - with it's log buffer lock and console path - is a
+ * bottleneck. llkd_blog_printf() doesn't format anything: it writes a binary
+ * record - timestamp, format string pointer and the arguments packed via
+ * vbin_printf(), as trace_printk() does - into the local CPU's ring buffer,
+ * with local interrupts briefly off and no lock at all. Formatting is deferred
+ * until the log's read, via debugfs:
+ *   /sys/kernel/debug/<name>/log    : the records, all CPUs merged in
+ *                                     timestamp order
+ *   /sys/kernel/debug/<name>/stats  : per CPU records written, overwritten
+ *   /sys/kernel/debug/<name>/clear  : write anything to it to clear the log
+ * The rings overwrite their oldest records when full. Reads don't consume,
+ * and never block writers: a record overwritten while being read is skipped.
+ * The format string must outlive the log (a literal in the module creating it
+ * is fine). On kernels without CONFIG_BINARY_PRINTF, we fall back to
+ * formatting upfront (vsnprintf()) - still lockless, just slower.
+ * Not for use from NMI context (such records are dropped and counted).
+ */
+#define LLKD_BLOG_DEF_SIZE   (64 * 1024)	/* default per-CPU ring size (bytes) */
+#define LLKD_BLOG_MAX_ARGS   256	/* max (packed) args or message per record (bytes) */
+
+struct llkd_blog_cpu {
+	char *buf;
+	u64 head;		/* total bytes ever written; the next record goes here */
+	u64 tail;		/* the oldest record still in the ring */
+	u64 floor;		/* set by 'clear': don't show records before this */
+	unsigned long nwritten, noverwritten, nnmi;
+};
+
+struct llkd_blog {
+	const char *name;
+	unsigned int size;	/* per-CPU ring size; a power of 2 */
+	struct llkd_blog_cpu __percpu *pcpu;
+	struct dentry *dbgdir;
+};
+
+struct llkd_blog *llkd_blog_create(const char *name, unsigned int size);
+void llkd_blog_destroy(struct llkd_blog *b);
+__printf(2, 0) void llkd_blog_vprintf(struct llkd_blog *b, const char *fmt, va_list args);
+__printf(2, 3) void llkd_blog_printf(struct llkd_blog *b, const char *fmt, ...);
+
+
+/*------------------- timing histograms ----------------------------------
+ * Named, per-CPU latency histograms, to profile any code path in place:
+ *   static struct llkd_hist *h;
+ *   u64 t;
+ *   h = llkd_hist_create("foo_xmit", NULL);	// in init
+ *   ...
+ *   LLKD_TIME_START(t);
+ *   <the code to time>
+ *   LLKD_TIME_END(h, t);
+ * Buckets are log-linear: 2^LLKD_HIST_SUB_BITS linear buckets per power of 2,
+ * i.e., ~6% resolution at any magnitude, up to 2^LLKD_HIST_MAX_BITS ns (~68 s).
+ * Recording is inline - a couple of local_clock() reads and a per-CPU bucket
+ * increment with local interrupts briefly off - so it costs a few tens of ns
+ * at most. The per CPU and merged results - samples, min/avg/max and
+ * percentiles - are at /sys/kernel/debug/[<parent>/]<name>/summary, the full
+ * histograms (gnuplot-ready) in 'histogram' alongside; write to 'reset' to
+ * clear them. llkd_hist_log() logs the merged summary to the kernel log.
+ * Note: local_clock() is fast but only roughly synchronized across CPUs; a
+ * region that migrates between START and END may be a bit off.
+ */
+#define LLKD_HIST_SUB_BITS	4
+#define LLKD_HIST_SUB		(1U << LLKD_HIST_SUB_BITS)
+#define LLKD_HIST_MAX_BITS	36
+#define LLKD_HIST_NBUCKETS	((LLKD_HIST_MAX_BITS - LLKD_HIST_SUB_BITS + 1) * LLKD_HIST_SUB)
+
+struct llkd_hist_cpu {
+	u64 count, sum, min, max;
+	u64 hist[LLKD_HIST_NBUCKETS];
+};
+
+struct llkd_hist {
+	const char *name;
+	struct llkd_hist_cpu __percpu *pcpu;
+	struct dentry *dbgdir;
+};
+
+struct llkd_hist *llkd_hist_create(const char *name, struct dentry *parent);
+void llkd_hist_destroy(struct llkd_hist *h);
+void llkd_hist_reset(struct llkd_hist *h);
+void llkd_hist_log(struct llkd_hist *h);
+
+static inline unsigned int llkd_hist_bucket(u64 v)
+{
+	int shift = fls64(v) - 1 - LLKD_HIST_SUB_BITS;
+	unsigned int idx;
+
+	if (shift < 0)
+		shift = 0;
+	idx = shift * LLKD_HIST_SUB + (unsigned int)(v >> shift);
+	return min_t(unsigned int, idx, LLKD_HIST_NBUCKETS - 1);
+}
+
+/* Record the value @ns into @h (a NULL @h is ignored); any context */
+static inline void llkd_hist_record(struct llkd_hist *h, u64 ns)
+{
+	struct llkd_hist_cpu *hc;
+	unsigned long flags;
+
+	if (!h)
+		return;
+	local_irq_save(flags);
+	hc = this_cpu_ptr(h->pcpu);
+	hc->count++;
+	hc->sum += ns;
+	if (ns < hc->min)
+		hc->min = ns;
+	if (ns > hc->max)
+		hc->max = ns;
+	hc->hist[llkd_hist_bucket(ns)]++;
+	local_irq_restore(flags);
+}
+
+/* @t : a u64 variable of the caller's, holding the start timestamp */
+#define LLKD_TIME_START(t)	((t) = local_clock())
+#define LLKD_TIME_END(h, t)	llkd_hist_record((h), local_clock() - (t))
+
 #endif
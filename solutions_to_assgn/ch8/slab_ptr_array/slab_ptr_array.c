@@ -27,31 +27,225 @@
  * Tip: take care to handle the error case where a memory allocation fails;
  * don't forget to free the allocations already performed!
  *
+ * Additionally, when the module parameter 'bulk_bench' is set, we benchmark
+ * allocating and freeing batches of 1 KB objects (batch sizes 8 to 4096)
+ * one at a time vs via the slab layer's bulk APIs:
+ *  - kmalloc()/kfree() loop           vs  kmalloc() loop + kfree_bulk()
+ *  - kmem_cache_[alloc|free]() loop   vs  kmem_cache_[alloc|free]_bulk()
+ * (the latter pair on a dedicated custom slab cache).
+ *  sudo insmod ./slab_ptr_array_lkm.ko bulk_bench=1 [bulk_reps=100]
+ *
+ * With 'track=1', our allocations go via the klib_llkd object lifetime/leak
+ * tracker; objects outstanding (by allocation call site) can be seen in
+ * /sys/kernel/debug/slab_ptr_array/outstanding, and any still there at
+ * unload are reported as leaks. (The bulk benchmark then also shows the
+ * tracker's overhead.) 'fail_at=N' simulates the N'th kmalloc() failing, to
+ * exercise the init error path, and 'inject_leak=1' has our cleanup
+ * deliberately 'forget' to free gkptr[0], to see the tracker report a leak:
+ *  sudo insmod ./slab_ptr_array_lkm.ko track=1 fail_at=3
+ *  sudo insmod ./slab_ptr_array_lkm.ko track=1 inject_leak=1 ; sudo rmmod slab_ptr_array_lkm
+ *
  * For details, please refer the book, Ch 8.
  */
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/ktime.h>
+#include "../../../klib_llkd.h"
 
 #define OURMODNAME       "slab_ptr_array"
 #define SLAB_MAXLOOP    5
+#define BULK_OBJSZ      1024
+#define BULK_MINBATCH   8
+#define BULK_MAXBATCH   4096
 
 MODULE_AUTHOR("Kaiwan N Billimoria");
 MODULE_DESCRIPTION("LKDC book:solutions_to_assgn/ch8/slab_ptr_array/: assignment solution");
 MODULE_LICENSE("Dual MIT/GPL");
 MODULE_VERSION("0.1");
 
+static int bulk_bench;
+module_param(bulk_bench, int, 0444);
+MODULE_PARM_DESC(bulk_bench, "if 1, also benchmark per-object vs bulk slab alloc/free (default=0)");
+
+static uint bulk_reps = 100;
+module_param(bulk_reps, uint, 0444);
+MODULE_PARM_DESC(bulk_reps, "number of repetitions per batch size in the bulk benchmark (default=100)");
+
+static int track;
+module_param(track, int, 0444);
+MODULE_PARM_DESC(track, "if 1, track our allocations with the klib_llkd leak tracker (default=0)");
+
+static int fail_at = -1;
+module_param(fail_at, int, 0444);
+MODULE_PARM_DESC(fail_at, "simulate the kmalloc() of gkptr[fail_at] failing (default=-1: never)");
+
+static int inject_leak;
+module_param(inject_leak, int, 0444);
+MODULE_PARM_DESC(inject_leak, "if 1, deliberately leak gkptr[0] at unload, for the leak tracker to catch (default=0)");
+
 static char *gkptr[SLAB_MAXLOOP];
+static struct llkd_track *gtrack;
+
+enum bulk_mode {
+	KMALLOC_LOOP = 0,	/* kmalloc() + kfree() one at a time */
+	KMALLOC_KFREE_BULK,	/* kmalloc() one at a time + kfree_bulk() */
+	CACHE_LOOP,		/* kmem_cache_alloc() + kmem_cache_free() one at a time */
+	CACHE_BULK,		/* kmem_cache_alloc_bulk() + kmem_cache_free_bulk() */
+	KMALLOC_TRACKED,	/* as KMALLOC_LOOP, but via the leak tracker */
+	BULK_MODE_MAX
+};
+
+/*
+ * bulk_time_batch - allocate and free @batch objects, bulk_reps times, via
+ * the given @mode; returns 0 and the average time per object (alloc + free)
+ * in *@ns, or -ENOMEM on allocation failure.
+ */
+static int bulk_time_batch(struct kmem_cache *cachep, void **ptrs,
+			   unsigned int batch, enum bulk_mode mode, u64 *ns)
+{
+	unsigned int i, r;
+	u64 t1, t2;
+
+	t1 = ktime_get_ns();
+	for (r = 0; r < bulk_reps; r++) {
+		switch (mode) {
+		case KMALLOC_LOOP:
+		case KMALLOC_KFREE_BULK:
+			for (i = 0; i < batch; i++) {
+				ptrs[i] = kmalloc(BULK_OBJSZ, GFP_KERNEL);
+				if (!ptrs[i]) {
+					kfree_bulk(i, ptrs);
+					return -ENOMEM;
+				}
+			}
+			if (mode == KMALLOC_LOOP) {
+				for (i = 0; i < batch; i++)
+					kfree(ptrs[i]);
+			} else
+				kfree_bulk(batch, ptrs);
+			break;
+		case CACHE_LOOP:
+			for (i = 0; i < batch; i++) {
+				ptrs[i] = kmem_cache_alloc(cachep, GFP_KERNEL);
+				if (!ptrs[i]) {
+					kmem_cache_free_bulk(cachep, i, ptrs);
+					return -ENOMEM;
+				}
+			}
+			for (i = 0; i < batch; i++)
+				kmem_cache_free(cachep, ptrs[i]);
+			break;
+		case KMALLOC_TRACKED:
+			for (i = 0; i < batch; i++) {
+				ptrs[i] = llkd_track_kmalloc(gtrack, BULK_OBJSZ, GFP_KERNEL);
+				if (!ptrs[i]) {
+					while (i--)
+						llkd_track_kfree(gtrack, ptrs[i]);
+					return -ENOMEM;
+				}
+			}
+			for (i = 0; i < batch; i++)
+				llkd_track_kfree(gtrack, ptrs[i]);
+			break;
+		case CACHE_BULK:
+			/* all-or-nothing: returns 0 (and frees any partial allocs) on failure */
+			if (!kmem_cache_alloc_bulk(cachep, GFP_KERNEL, batch, ptrs))
+				return -ENOMEM;
+			kmem_cache_free_bulk(cachep, batch, ptrs);
+			break;
+		default:
+			return -EINVAL;
+		}
+		cond_resched();
+	}
+	t2 = ktime_get_ns();
+
+	*ns = div64_u64(t2 - t1, (u64)bulk_reps * batch);
+	return 0;
+}
+
+/* Format the table column @mode's ns value, or "fail", right-aligned in @w */
+static int bulk_col(char *buf, size_t len, int w, const u64 *ns, const int *err, int mode)
+{
+	if (err[mode])
+		return scnprintf(buf, len, " : %*s", w, "fail");
+	return scnprintf(buf, len, " : %*llu", w, ns[mode]);
+}
+
+static int bulk_benchmark(void)
+{
+	static const int width[BULK_MODE_MAX] = { 13, 11, 16, 10, 8 };
+	struct kmem_cache *cachep;
+	unsigned int batch;
+	u64 ns[BULK_MODE_MAX];
+	int err[BULK_MODE_MAX];
+	char row[160];
+	void **ptrs;
+	int mode, n, ret = 0;
+
+	if (!bulk_reps)
+		return -EINVAL;
+	ptrs = kvmalloc_array(BULK_MAXBATCH, sizeof(void *), GFP_KERNEL);
+	if (!ptrs)
+		return -ENOMEM;
+	cachep = kmem_cache_create("slab_ptr_array_1k", BULK_OBJSZ, sizeof(long),
+				   SLAB_HWCACHE_ALIGN, NULL);
+	if (!cachep) {
+		kvfree(ptrs);
+		return -ENOMEM;
+	}
+
+	pr_info("%s: per-object vs bulk alloc+free of %d byte objects (ns/object, %u reps)\n",
+		OURMODNAME, BULK_OBJSZ, bulk_reps);
+	pr_info(" batch : kmalloc+kfree : +kfree_bulk : cache_alloc+free : cache_bulk : tracked kmalloc+kfree\n");
+	for (batch = BULK_MINBATCH; batch <= BULK_MAXBATCH; batch *= 2) {
+		for (mode = 0; mode < BULK_MODE_MAX; mode++) {
+			ns[mode] = 0;
+			err[mode] = 0;
+			if (mode == KMALLOC_TRACKED && !gtrack)
+				continue;
+			err[mode] = bulk_time_batch(cachep, ptrs, batch, mode, &ns[mode]);
+			if (err[mode])
+				ret = err[mode];	/* report it, and carry on */
+		}
+		n = scnprintf(row, sizeof(row), " %5u", batch);
+		for (mode = 0; mode < KMALLOC_TRACKED; mode++)
+			n += bulk_col(row + n, sizeof(row) - n, width[mode], ns, err, mode);
+		if (!gtrack)
+			n += scnprintf(row + n, sizeof(row) - n, " : -");
+		else {
+			n += bulk_col(row + n, sizeof(row) - n, width[KMALLOC_TRACKED], ns, err,
+				      KMALLOC_TRACKED);
+			/* show the tracking overhead as a % of the untracked loop */
+			if (!err[KMALLOC_TRACKED] && !err[KMALLOC_LOOP] && ns[KMALLOC_LOOP])
+				n += scnprintf(row + n, sizeof(row) - n, " (%+lld%%)",
+					div64_s64(((s64)ns[KMALLOC_TRACKED] -
+						   (s64)ns[KMALLOC_LOOP]) * 100, ns[KMALLOC_LOOP]));
+		}
+		pr_info("%s\n", row);
+	}
+	kmem_cache_destroy(cachep);
+	kvfree(ptrs);
+	return ret;
+}
 
 static int __init slab_ptr_array_init(void)
 {
-	int i = 0, j;
+	int i = 0;
 
 	pr_info("%s: inserted\n", OURMODNAME);
+	if (track) {
+		gtrack = llkd_track_create(OURMODNAME);
+		if (!gtrack)
+			pr_warn("%s: couldn't set up the leak tracker, continuing untracked\n",
+				OURMODNAME);
+	}
 
 	while (i < SLAB_MAXLOOP) {
-		gkptr[i] = kmalloc(1024, GFP_KERNEL);
+		gkptr[i] = (i == fail_at) ? NULL : llkd_track_kmalloc(gtrack, 1024, GFP_KERNEL);
 		if (!gkptr[i]) {
 			// pedantic warning, unnecessary in production code
 			pr_warn("%s: kmalloc iter %d failed!\n", OURMODNAME, i);
@@ -65,12 +259,16 @@ static int __init slab_ptr_array_init(void)
 		i++;
 	}
 
+	if (bulk_bench && bulk_benchmark() < 0)
+		pr_warn("%s: bulk benchmark couldn't run, or had allocation failures ('fail' entries)\n", OURMODNAME);
+
 	return 0;		/* success */
 cleanup:
-	for (j = i; j > 0; j--) {
-		pr_debug(" freeing gkptr[%d]\n", j);
-		kfree(gkptr[j]);
+	while (i--) {
+		pr_debug(" freeing gkptr[%d]\n", i);
+		llkd_track_kfree(gtrack, gkptr[i]);
 	}
+	llkd_track_destroy(gtrack);
 	return -ENOMEM;
 }
 
@@ -79,10 +277,15 @@ static void __exit slab_ptr_array_cleanup(void)
 	int i;
 
 	for (i = 0; i < SLAB_MAXLOOP; i++) {
+		if (i == 0 && inject_leak) {
+			pr_info("%s: deliberately leaking gkptr[0] (inject_leak=1)\n", OURMODNAME);
+			continue;
+		}
 		pr_debug("%s:%s(): freeing gkptr[%d]\n",
 			OURMODNAME, __func__, i);
-		kfree(gkptr[i]);
+		llkd_track_kfree(gtrack, gkptr[i]);
 	}
+	llkd_track_destroy(gtrack);
 	pr_info("%s: freed memory, removed\n", OURMODNAME);
 }
 
@@ -35,6 +35,19 @@
  * to see how much memory is *actually* allocated to each object in each custom
  * slab cache (it's the fourth column, as we saw earlier).
  * 
+ * Footprint report:
+ * We keep 'nobjs' objects allocated from each cache, and report, per cache:
+ * the requested and actual object size, objects per slab, slab order, our
+ * objects vs the (estimated) capacity of the slabs holding them, whether the
+ * cache got merged with an existing (f.e. kmalloc) cache, and the memory of
+ * those slabs. See it via
+ *  sudo cat /sys/kernel/debug/slab_custom_mult/report
+ * Where the SLUB struct kmem_cache definition is visible to modules (kernels
+ * < 6.8), the per-cache metadata is used directly; otherwise it's derived by
+ * observing which slab (page block) each object lands in. Load with
+ * dbg_flags=0 to create the caches without the debug flags and thus let the
+ * kernel merge them.
+ * 
  * For details, please refer the book, Ch 9.
  */
 #define pr_fmt(fmt) "%s:%s(): " fmt, KBUILD_MODNAME, __func__
@@ -44,6 +57,16 @@
 #include <linux/kernel.h>
 #include <linux/slab.h>
 #include <linux/version.h>
+#include <linux/mm.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sort.h>
+#if defined(CONFIG_SLUB) && LINUX_VERSION_CODE < KERNEL_VERSION(6, 8, 0)
+#include <linux/slub_def.h>
+#define HAVE_SLUB_DEF	1
+#define OO_SHIFT	16	/* as in mm/slub.c */
+#define OO_MASK		((1 << OO_SHIFT) - 1)
+#endif
 
 #define OURMODNAME   "slab_custom_mult"
 #define OURCACHENAME "our_slab"
@@ -67,9 +90,27 @@ static int xfactor = 300;
 module_param(xfactor, int, 0644);
 MODULE_PARM_DESC(xfactor, "multiplier factor by which custom cache size increases [def=300]");
 
+static int nobjs = 4;
+module_param(nobjs, int, 0444);
+MODULE_PARM_DESC(nobjs, "# of objects to keep allocated from each cache [def=4]");
+
+static int dbg_flags = 1;
+module_param(dbg_flags, int, 0444);
+MODULE_PARM_DESC(dbg_flags, "create caches with SLAB_POISON|SLAB_RED_ZONE (which prevents merging) [def=1]");
+
 /* An array of pointers to our custom 'llkd' slab caches */
 static struct kmem_cache *our_llkd_cachep[OURMAX_CACHES];
 
+/* Per-cache info for the footprint report */
+struct cache_info {
+	size_t reqsz;			/* the object size we asked for */
+	unsigned int objs_per_slab, order;
+	bool merged;
+	void **objs;			/* our 'nobjs' live objects */
+};
+static struct cache_info our_info[OURMAX_CACHES];
+static struct dentry *gparent;
+
 static void use_our_cache(int idx)
 {
 	void *obj = NULL;
@@ -104,7 +145,7 @@ static int create_cust_llkd_cache(int idx, size_t sz)
 	memset(nm, 0, 128);
 	snprintf(nm, 127, "%s-%d", OURCACHENAME, idx);
 	our_llkd_cachep[idx] = kmem_cache_create(nm, sz, 0,
-			SLAB_POISON | SLAB_RED_ZONE | SLAB_HWCACHE_ALIGN,
+			(dbg_flags ? SLAB_POISON | SLAB_RED_ZONE : 0) | SLAB_HWCACHE_ALIGN,
 			NULL);
 	if (!our_llkd_cachep[idx]) {
 		pr_warn("kmem_cache_create() on index %d failed\n", idx);
@@ -112,10 +153,138 @@ static int create_cust_llkd_cache(int idx, size_t sz)
 			err = PTR_ERR(our_llkd_cachep[idx]);
 		return err;
 	}
+	our_info[idx].reqsz = sz;
 	
 	return 0;
 }
 
+/*
+ * probe_cache_geometry - fill in the objects per slab, slab order and merged
+ * status of cache @idx; from the kmem_cache metadata if we can see it, else
+ * by allocating objects until one lands outside the first one's slab.
+ */
+static void probe_cache_geometry(int idx)
+{
+	struct kmem_cache *cachep = our_llkd_cachep[idx];
+	struct cache_info *ci = &our_info[idx];
+#ifdef HAVE_SLUB_DEF
+	char nm[128];
+
+	snprintf(nm, 127, "%s-%d", OURCACHENAME, idx);
+	ci->order = cachep->oo.x >> OO_SHIFT;
+	ci->objs_per_slab = cachep->oo.x & OO_MASK;
+	/* If merged (aliased), we got back an existing cache, with it's own name */
+	ci->merged = strcmp(cachep->name, nm) != 0 || cachep->refcount > 1;
+#else
+#define PROBE_MAX  1024
+	void **probe;
+	struct page *first;
+	unsigned int n = 0;
+
+	/* A merged cache hands back objects sized for the cache we aliased to */
+	ci->merged = kmem_cache_size(cachep) != ci->reqsz;
+	probe = kcalloc(PROBE_MAX, sizeof(void *), GFP_KERNEL);
+	if (!probe)
+		return;
+	probe[n] = kmem_cache_alloc(cachep, GFP_KERNEL);
+	if (!probe[n])
+		goto out;
+	first = virt_to_head_page(probe[n]);
+	ci->order = compound_order(first);
+	for (n = 1; n < PROBE_MAX; n++) {
+		probe[n] = kmem_cache_alloc(cachep, GFP_KERNEL);
+		if (!probe[n] || virt_to_head_page(probe[n]) != first)
+			break;
+	}
+	/* (an estimate: a merged cache's first slab may already have been in use) */
+	ci->objs_per_slab = n;
+	if (n < PROBE_MAX && probe[n])
+		n++;
+out:
+	while (n--)
+		if (probe[n])
+			kmem_cache_free(cachep, probe[n]);
+	kfree(probe);
+#endif
+}
+
+static int cmp_ptr(const void *a, const void *b)
+{
+	unsigned long x = (unsigned long)*(void * const *)a;
+	unsigned long y = (unsigned long)*(void * const *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Count the distinct slabs our live objects of cache @idx live in: sort (a
+ * copy of) their pointers, so that objects sharing a slab are adjacent.
+ */
+static unsigned int count_our_slabs(int idx)
+{
+	struct cache_info *ci = &our_info[idx];
+	struct page *pg, *prev = NULL;
+	unsigned int i, n = 0, nslabs = 0;
+	void **objs;
+
+	if (!ci->objs)
+		return 0;
+	objs = kmalloc_array(nobjs, sizeof(void *), GFP_KERNEL);
+	if (!objs)
+		return 0;
+	for (i = 0; i < nobjs; i++)
+		if (ci->objs[i])
+			objs[n++] = ci->objs[i];
+	sort(objs, n, sizeof(void *), cmp_ptr, NULL);
+	for (i = 0; i < n; i++) {
+		pg = virt_to_head_page(objs[i]);
+		if (pg != prev)
+			nslabs++;
+		prev = pg;
+	}
+	kfree(objs);
+	return nslabs;
+}
+
+static int report_show(struct seq_file *m, void *unused)
+{
+	struct cache_info *ci;
+	unsigned int nslabs, ours, capacity;
+	size_t mem, totmem = 0;
+	int i, j, ncaches = 0, nmerged = 0;
+
+	seq_printf(m, "%-13s %7s %7s %8s %5s %7s %8s %6s %10s\n",
+		   "cache", "reqsz", "objsz", "objs/slab", "order", "ourobjs", "capacity",
+		   "merged", "mem(bytes)");
+	for (i = 0; i < OURMAX_CACHES; i++) {
+		if (!our_llkd_cachep[i])
+			continue;
+		ci = &our_info[i];
+		nslabs = count_our_slabs(i);
+		for (ours = 0, j = 0; j < nobjs; j++)
+			if (ci->objs && ci->objs[j])
+				ours++;
+		capacity = nslabs * ci->objs_per_slab;
+		mem = (size_t)nslabs * (PAGE_SIZE << ci->order);
+		totmem += mem;
+		ncaches++;
+		nmerged += ci->merged;
+		seq_printf(m, "%s-%-4d %7zu %7u %8u %5u %7u %8u %6s %10zu\n",
+			   OURCACHENAME, i, ci->reqsz, kmem_cache_size(our_llkd_cachep[i]),
+			   ci->objs_per_slab, ci->order, ours, capacity,
+			   ci->merged ? "yes" : "no", mem);
+	}
+	seq_printf(m, "total: %d caches (%d merged), %zu KB of slab memory for %d live objects each\n",
+		   ncaches, nmerged, totmem >> 10, nobjs);
+	seq_puts(m, "(ourobjs: our live objects; capacity and mem: of just the slabs they're in, "
+		 "estimated - a merged cache's slabs also hold other users' objects)\n");
+#ifndef HAVE_SLUB_DEF
+	seq_puts(m, "(objs/slab, order and merged were derived empirically, not from metadata)\n");
+#endif
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(report);
+
 static int create_our_llkd_caches(void)
 {
 	int i;
@@ -132,8 +301,12 @@ static int create_our_llkd_caches(void)
 
 static int __init slab_custom_mult_init(void)
 {
-	int i, ret;
+	int i, j, ret;
 
+	if (nobjs < 0 || nobjs > 4096) {
+		pr_info("nobjs must be in the range [0..4096]\n");
+		return -EINVAL;
+	}
 	pr_info("# custom caches to create = %d, xfactor=%d, MAX_ALLOW=%d\n",
 		OURMAX_CACHES, xfactor, MAX_ALLOW);
 	if ((OURMAX_CACHES*xfactor) >= MAX_ALLOW) {
@@ -149,19 +322,38 @@ static int __init slab_custom_mult_init(void)
 		return -ENOMEM;
 	}
 
-	for (i = 0; i < OURMAX_CACHES; i++)
+	for (i = 0; i < OURMAX_CACHES; i++) {
 		use_our_cache(i);
+		probe_cache_geometry(i);
+		/* keep 'nobjs' objects live, so that the slabs stay populated */
+		our_info[i].objs = kcalloc(nobjs, sizeof(void *), GFP_KERNEL);
+		for (j = 0; our_info[i].objs && j < nobjs; j++)
+			our_info[i].objs[j] = kmem_cache_alloc(our_llkd_cachep[i], GFP_KERNEL);
+	}
+
+	/* debugfs: the footprint report */
+	gparent = debugfs_create_dir(OURMODNAME, NULL);
+	if (IS_ERR_OR_NULL(gparent))
+		pr_warn("debugfs_create_dir() failed; no footprint report\n");
+	else
+		debugfs_create_file("report", 0444, gparent, NULL, &report_fops);
 
 	return 0;		/* success */
 }
 
 static void __exit slab_custom_mult_exit(void)
 {
-	int i;
+	int i, j;
 
+	debugfs_remove_recursive(gparent);
 	pr_info("freeing custom caches from 0 to %d ...\n", OURMAX_CACHES-1);
-	for (i = 0; i < OURMAX_CACHES; i++)
+	for (i = 0; i < OURMAX_CACHES; i++) {
+		for (j = 0; our_info[i].objs && j < nobjs; j++)
+			if (our_info[i].objs[j])
+				kmem_cache_free(our_llkd_cachep[i], our_info[i].objs[j]);
+		kfree(our_info[i].objs);
 		kmem_cache_destroy(our_llkd_cachep[i]);
+	}
 	pr_info("removed\n");
 }
 